@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -9,6 +9,9 @@
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
+// * To have I/O on many blocks in flight at once, start it with
+//     bread_async or bwrite_async, and finish it with bwait.
+//     Between bplug and bunplug, I/O on adjacent blocks is merged.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
@@ -16,74 +19,272 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
-struct {
+#define NBUCKET 13 // hash buckets; prime, so block numbers spread out
+
+// The cache is a hash table keyed on (dev, blockno). Each bucket
+// has its own lock and list of buffers, so lookups of different
+// blocks don't serialize. Buffers are recycled least recently
+// released first, by b->lastuse, which replaces the global LRU
+// list; finding one means looking at every bucket, so recycling
+// is serialized by bcache.lock, and only recycling takes more
+// than one bucket lock.
+//
+// The cache starts with the NBUF buffers in bcache.buf and grows
+// a page of buffers at a time, from kcachealloc(), up to
+// BCACHEPCT percent of RAM, rather than recycle a buffer that
+// may still be wanted. kalloc() takes idle pages back through
+// bshrink() when memory runs out. A container that fills its
+// buf_limit share of the cache recycles its own buffers.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head; // bufs hashed here, through prev/next
+};
+
+// a page of buffers
+struct bpage {
+  struct bpage *next;
+  struct buf buf[(PGSIZE - sizeof(struct bpage*)) / sizeof(struct buf)];
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+#define BPERPAGE NELEM(((struct bpage*)0)->buf)
+
+struct {
+  struct spinlock lock; // serializes recycling, growing and shrinking
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct buf spare;     // bufs never used yet, through prev/next
+  struct bpage *pages;  // pages of bufs from kcachealloc()
+  int nbuf;             // bufs in the cache
+  int maxbuf;           // most it may grow to
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+blink(struct buf *head, struct buf *b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  bcache.spare.prev = &bcache.spare;
+  bcache.spare.next = &bcache.spare;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    blink(&bcache.spare, b);
   }
+  bcache.nbuf = NBUF;
+  bcache.maxbuf = NBUF + (PHYSTOP - KERNBASE) / PGSIZE * BCACHEPCT / 100 * BPERPAGE;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block blockno of dev in bucket bk, whose lock the
+// caller holds, and take a reference to it.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached; recycle an unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Take a spare buf, if need be adding a page of them to the
+// cache. Returns 0 if the cache is at its largest or memory
+// is short. Caller holds bcache.lock.
+static struct buf*
+bgrow(void)
+{
+  struct bpage *pg;
+  struct buf *b;
+
+  if(bcache.spare.next == &bcache.spare){
+    if(bcache.nbuf + BPERPAGE > bcache.maxbuf || (pg = kcachealloc()) == 0)
+      return 0;
+    for(b = pg->buf; b < pg->buf+BPERPAGE; b++){
+      initsleeplocknostat(&b->lock, "buffer");
+      b->refcnt = 0;
+      b->owner = 0;
+      blink(&bcache.spare, b);
     }
+    pg->next = bcache.pages;
+    bcache.pages = pg;
+    bcache.nbuf += BPERPAGE;
+  }
+  b = bcache.spare.next;
+  bunlink(b);
+  return b;
+}
+
+// Find the least recently used unreferenced buf, only among
+// those owned by c unless c is 0, and take it out of its
+// bucket. Caller holds bcache.lock and the lock of bucket bk;
+// those are the only bucket locks that may be held for long
+// while looking, so bk->lock stays held throughout, and of
+// the others only that of the best candidate so far, so that
+// it can't be taken from under us.
+static struct buf*
+blru(struct bucket *bk, struct container *c)
+{
+  struct buf *b, *lru;
+  struct bucket *lbk, *k;
+
+  lru = 0;
+  lbk = 0;
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    if(k != bk)
+      acquire(&k->lock);
+    for(b = k->head.next; b != &k->head; b = b->next){
+      if(b->refcnt == 0 && (c == 0 || b->owner == c) &&
+         (lru == 0 || b->lastuse < lru->lastuse)){
+        lru = b;
+        if(lbk != k){
+          if(lbk && lbk != bk)
+            release(&lbk->lock);
+          lbk = k;
+        }
+      }
+    }
+    if(k != bk && k != lbk)
+      release(&k->lock);
+  }
+  if(lru){
+    bunlink(lru);
+    if(lbk != bk)
+      release(&lbk->lock);
+  }
+  return lru;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return the buffer, referenced but not
+// locked, and set *cached to whether it was found.
+static struct buf*
+bfind(uint dev, uint blockno, int *cached)
+{
+  struct buf *b;
+  struct bucket *bk;
+  struct container *c;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+
+  // Is the block already cached?
+  *cached = 1;
+  if((b = blookup(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Not cached. Look again once recycling is ours, since
+  // another process may have brought the block in meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    return b;
+  }
+  *cached = 0;
+
+  // a container that fills its share recycles its own buffers;
+  // otherwise grow the cache while memory allows, and recycle
+  // the least recently used buffer once it doesn't.
+  c = mycontainer();
+  b = 0;
+  if(cbuffull(c, bcache.maxbuf))
+    b = blru(bk, c);
+  if(b == 0)
+    b = bgrow();
+  if(b == 0)
+    b = blru(bk, 0);
+  if(b == 0)
+    panic("bget: no buffers");
+
+  if(b->owner != c){
+    if(b->owner)
+      cusage(&b->owner->buf_usage, -1);
+    cusage(&c->buf_usage, 1);
+    b->owner = c;
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  blink(&bk->head, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
+}
+
+// Return a locked buffer for block blockno of dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int cached;
+
+  b = bfind(dev, blockno, &cached);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Drop a reference to b, stamping it for LRU recycling
+// once no one uses it.
+static void
+bunref(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = mtime();
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -92,25 +293,99 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
+  b = bread_async(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// Write b's contents to disk.  Must be locked.
+void
+bwrite(struct buf *b)
+{
+  bwrite_async(b);
+  bwait(b);
+}
+
+// Return a locked buf for the indicated block, with a read of
+// its contents started if it has none, without waiting for the
+// read. Call bwait() before using the contents, so that reads
+// of many blocks can be in flight at once.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b->dev, b, 0);
-    b->valid = 1;
+    b->iodone = 0;
+    virtio_disk_start(b->dev, b, 0);
   }
   return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Start writing b's contents to disk without waiting.
+// Must be locked, and stay locked until bwait().
 void
-bwrite(struct buf *b)
+bwrite_async(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b->dev, b, 1);
+  b->iodone = 0;
+  virtio_disk_start(b->dev, b, 1);
+}
+
+// Start writing b, a buffer of the caller's own rather than
+// one from the cache, to block blockno of b->dev, without
+// waiting. For the log, which writes a snapshot of a block to
+// the log and then home while the cached block moves on.
+void
+bwrite_at(struct buf *b, uint blockno)
+{
+  b->blockno = blockno;
+  b->iodone = 0;
+  virtio_disk_start(b->dev, b, 1);
+}
+
+// Return a locked buf for the indicated block without reading
+// it, for a caller that is going to overwrite all of it.
+struct buf*
+bcreate(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
+// Hold back the I/O started on dev until bunplug(), so that
+// requests for adjacent blocks go to the disk as one.
+void
+bplug(uint dev)
+{
+  virtio_disk_plug(dev);
+}
+
+void
+bunplug(uint dev)
+{
+  virtio_disk_unplug(dev);
+}
+
+// Wait for I/O started by bread_async() or bwrite_async()
+// on b, after which b holds the block's contents.
+void
+bwait(struct buf *b)
+{
+  // the disk interrupt clears b->disk once the data is in
+  // place; only wait under the driver's lock if it hasn't.
+  if(*(volatile int*)&b->disk)
+    virtio_disk_wait(b->dev, b);
+  __sync_synchronize();
+  b->valid = 1;
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -118,34 +393,110 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bunref(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// The disk interrupt's end of breadahead().
+static void
+breadahead_done(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Start reading block blockno of dev into the cache, unless
+// it is there already, and return without waiting. The buffer
+// stays locked while the read is in flight, so bread() of the
+// block waits for it. Returns -1 if the disk queue is full.
+int
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  int cached;
+
+  b = bfind(dev, blockno, &cached);
+  if(cached){
+    bunref(b);
+    return 0;
+  }
+  acquiresleep(&b->lock);
+  // someone else may have read it in since bfind().
+  if(b->valid){
+    brelse(b);
+    return 0;
+  }
+  b->iodone = breadahead_done;
+  if(virtio_disk_trystart(b->dev, b, 0) < 0){
+    brelse(b);
+    return -1;
+  }
+  return 0;
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Give up to n pages of buffers that no one is using back to
+// kalloc(), which calls this when memory runs out. Since kalloc()
+// may be called with any lock held, it doesn't wait for
+// bcache.lock. Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct bpage *pg, **pp, *freed;
+  struct bucket *bk;
+  struct buf *b;
+  int i;
+
+  if(!tryacquire(&bcache.lock))
+    return 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    acquire(&bk->lock);
+
+  freed = 0;
+  for(pp = &bcache.pages; (pg = *pp) != 0 && n > 0; ){
+    for(i = 0; i < BPERPAGE; i++)
+      if(pg->buf[i].refcnt)
+        break;
+    if(i < BPERPAGE){
+      pp = &pg->next;
+      continue;
+    }
+    for(b = pg->buf; b < pg->buf+BPERPAGE; b++){
+      bunlink(b);
+      if(b->owner)
+        cusage(&b->owner->buf_usage, -1);
+    }
+    bcache.nbuf -= BPERPAGE;
+    *pp = pg->next;
+    pg->next = freed;
+    freed = pg;
+    n--;
+  }
 
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    release(&bk->lock);
+  release(&bcache.lock);
+
+  for(i = 0; (pg = freed) != 0; i++){
+    freed = pg->next;
+    kcachefree(pg);
+  }
+  return i;
+}
@@ -5,7 +5,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint64 lastuse;   // mtime of the last brelse() to refcnt 0, for LRU
+  struct container *owner; // whose read brought the block in
+  void (*iodone)(struct buf*); // called by the disk interrupt, if set
+  int iowrite;      // queued to be written, rather than read
+  int iq;           // disk queue it was started on
+  uint64 iostart;   // mtime() when it was started
+  struct buf *qnext; // disk queue, then the rest of the op's bufs
+  struct buf *prev; // hash bucket list
   struct buf *next;
   uchar data[BSIZE];
 };
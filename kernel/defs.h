@@ -5,6 +5,8 @@ struct inode;
 struct pipe;
 struct proc;
 struct spinlock;
+struct rwlock;
+struct seqlock;
 struct sleeplock;
 struct stat;
 struct superblock;
@@ -14,10 +16,19 @@ struct container;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+int             breadahead(uint, uint);
+struct buf*     bread_async(uint, uint);
+void            bwrite_async(struct buf*);
+void            bwrite_at(struct buf*, uint);
+void            bwait(struct buf*);
+struct buf*     bcreate(uint, uint);
+void            bplug(uint);
+void            bunplug(uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(int);
 
 // console.c
 void            consoleinit(void);
@@ -28,6 +39,9 @@ void            consputc(int);
 int             exec(char*, char**);
 int				      resume(char* filename);
 
+// fdt.c
+int             bootparam(uint64, char*, int);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
@@ -67,12 +81,15 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit();
+void*           kcachealloc(void);
+void            kcachefree(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(int);
+void            begin_op(int, int);
 void            end_op(int);
+int             log_writebytes(int);
 void            crash_op(int,int);
 
 // pipe.c
@@ -88,9 +105,10 @@ void            printfinit(void);
 
 // proc.c
 int             cpuid(void);
+void            cpuonline(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             growproc(int, uint64*);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -109,6 +127,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeupproc(struct proc*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -118,9 +137,27 @@ int             cinfo(void);
 int				      suspend(int pid, struct file *f);
 int             cpause(char*);
 int             cresume(char*);
-int             cstart(int, char*, char*, char*, char*);
+int             cstart(int, char*, char*, char*, char*, uint64);
 int             cstop(char*);
 void            freememory(void);
+int             setaffinity(int, uint64);
+int             getaffinity(int);
+int             csetaffinity(char*, uint64);
+void            cpucharge(struct proc*, int);
+int             cpustat(uint64, int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             csetweight(char*, int);
+void            cusage(int*, int);
+int             cmemfull(struct container*, int);
+int             cprocfull(struct container*, int);
+int             cdiskfull(struct container*, int);
+int             cbuffull(struct container*, int);
+uint            croot(struct container*, char*);
+int             hartstat(uint64, int);
+int             csetrt(char*, int, int);
+int             needresched(void);
+int             schedstat(uint64, int, int);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -128,16 +165,35 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlocknostat(struct spinlock*, char*);
+int             tryacquire(struct spinlock*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 uint64          sys_ntas(void);
+void            initrwlock(struct rwlock*, char*);
+void            read_acquire(struct rwlock*);
+void            read_release(struct rwlock*);
+void            write_acquire(struct rwlock*);
+void            write_release(struct rwlock*);
+void            initseqlock(struct seqlock*, char*);
+void            write_seqlock(struct seqlock*);
+void            write_sequnlock(struct seqlock*);
+uint            read_seqbegin(struct seqlock*);
+int             read_seqretry(struct seqlock*, uint);
+int             lockbench(int, uint64);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initsleeplocknostat(struct sleeplock*, char*);
+void            sleeplockreset(void);
+void            sleeplockstat(void);
+
+// start.c
+extern int      hz;
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -156,11 +212,28 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int, uint64);
+int             futexwake(uint64, int);
+
+// timer.c
+struct timer;
+uint64          mtime(void);
+void            timerwheelinit(void);
+void            timeradd(struct timer*);
+void            timerdel(struct timer*);
+int             timersleep(uint64);
+int             timerintr(void);
+void            tickstop(void);
+void            tickstart(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
+extern struct seqlock tickslock;
+void            clockintr(void);
 void            usertrapret(void);
 
 // uart.c
@@ -174,6 +247,8 @@ void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
+int             kvmmapstack(uint64, uint64);
+void            kvmunmapstack(uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
@@ -197,6 +272,14 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(int);
 void            virtio_disk_rw(int, struct buf *, int);
+void            virtio_disk_start(int, struct buf *, int);
+int             virtio_disk_trystart(int, struct buf *, int);
+void            virtio_disk_wait(int, struct buf *);
+void            virtio_disk_plug(int);
+void            virtio_disk_unplug(int);
+int             diskstat(uint64, int);
+int             diskbench(uint64);
+int             diskpoll(int, int);
 void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
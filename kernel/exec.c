@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fs.h"
 #include "elf.h"
 #include "resume_header.h"
 
@@ -21,8 +22,11 @@ resume(char * filename)
   struct resumehdr rhdr;
   struct trapframe tf;
   struct proc *p;
+  //a threaded process can't swap out its image under its threads
+  if(myproc()->vm)
+    return -1;
   //open inode to file
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_IPUT);
   if((ip = namei(filename)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -103,8 +107,12 @@ exec(char *path, char **argv)
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+
+  // other threads would be left running in the old image.
+  if(p->vm)
+    return -1;
   
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_IPUT);
 
   if((ip = namei(path)) == 0){
     end_op(ROOTDEV);
@@ -0,0 +1,114 @@
+// Minimal flattened device tree reader.
+//
+// qemu passes the address of a device tree in a1 at boot, and
+// puts the kernel command line (qemu -append "...") in the
+// /chosen node's bootargs property. This is just enough of a
+// parser to find it. It runs in machine mode from start(),
+// before kinit() hands out the memory the tree lives in.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC       0xd00dfeed
+#define FDT_BEGIN_NODE  1
+#define FDT_END_NODE    2
+#define FDT_PROP        3
+#define FDT_NOP         4
+
+// all fields are big-endian.
+struct fdt_header {
+  uint32 magic;
+  uint32 totalsize;
+  uint32 off_dt_struct;
+  uint32 off_dt_strings;
+  uint32 off_mem_rsvmap;
+  uint32 version;
+  uint32 last_comp_version;
+  uint32 boot_cpuid_phys;
+  uint32 size_dt_strings;
+  uint32 size_dt_struct;
+};
+
+static uint32
+be32(void *p)
+{
+  uchar *b = p;
+  return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// Return /chosen/bootargs in the tree at fdt, or 0.
+static char*
+bootargs(uint64 fdt)
+{
+  struct fdt_header *h = (struct fdt_header*)fdt;
+  uint32 *p, len;
+  char *strings, *name;
+  int depth, chosen;
+
+  if(fdt == 0 || be32(&h->magic) != FDT_MAGIC)
+    return 0;
+  p = (uint32*)(fdt + be32(&h->off_dt_struct));
+  strings = (char*)(fdt + be32(&h->off_dt_strings));
+
+  depth = 0;
+  chosen = 0;
+  for(;;){
+    switch(be32(p++)){
+    case FDT_BEGIN_NODE:
+      // the root node is at depth 1, so /chosen is at depth 2.
+      name = (char*)p;
+      depth++;
+      if(depth == 2 && strncmp(name, "chosen", 7) == 0)
+        chosen = 1;
+      p += (strlen(name) + 1 + 3) / 4;
+      break;
+    case FDT_END_NODE:
+      if(depth == 2)
+        chosen = 0;
+      depth--;
+      break;
+    case FDT_PROP:
+      len = be32(p++);
+      name = strings + be32(p++);
+      if(chosen && strncmp(name, "bootargs", 9) == 0)
+        return (char*)p;
+      p += (len + 3) / 4;
+      break;
+    case FDT_NOP:
+      break;
+    default:
+      // FDT_END, or something we don't understand.
+      return 0;
+    }
+  }
+}
+
+// Return N if "name=N" is in the kernel command line,
+// or def if it isn't.
+int
+bootparam(uint64 fdt, char *name, int def)
+{
+  char *s;
+  int n, v;
+
+  if((s = bootargs(fdt)) == 0)
+    return def;
+  n = strlen(name);
+  while(*s){
+    while(*s == ' ')
+      s++;
+    if(strncmp(s, name, n) == 0 && s[n] == '='){
+      s += n + 1;
+      if(*s < '0' || *s > '9')
+        return def;
+      for(v = 0; *s >= '0' && *s <= '9'; s++)
+        v = v*10 + (*s - '0');
+      return v;
+    }
+    while(*s && *s != ' ')
+      s++;
+  }
+  return def;
+}
@@ -76,7 +76,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op(ff.ip->dev);
+    begin_op(ff.ip->dev, LOGOP_IPUT);
     iput(ff.ip);
     end_op(ff.ip->dev);
   }
@@ -146,20 +146,19 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as much at a time as one op can reserve log space
+    // for: the blocks the bytes may cover at any offset, and
+    // the i-node, indirect block and allocation blocks.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = log_writebytes(f->ip->dev);
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op(f->ip->dev);
+      begin_op(f->ip->dev, LOGOP_WRITE((n1 + BSIZE - 1) / BSIZE + 1));
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -195,20 +194,19 @@ filewritefromkernelspace(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(f, 0, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as much at a time as one op can reserve log space
+    // for: the blocks the bytes may cover at any offset, and
+    // the i-node, indirect block and allocation blocks.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = log_writebytes(f->ip->dev);
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op(f->ip->dev);
+      begin_op(f->ip->dev, LOGOP_WRITE((n1 + BSIZE - 1) / BSIZE + 1));
       ilock(f->ip);
       if ((r = writei(f->ip, 0, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -21,6 +21,9 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // block after the last one readi() read
+  uint raend;         // blocks before this are read ahead
+  uint rawin;         // readahead window, in blocks; 0 if random
 
   short type;         // copy of disk inode
   short major;
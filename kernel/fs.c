@@ -70,14 +70,11 @@ balloc(uint dev)
   struct container *c;
 
   c = mycontainer();
-  acquire(&c->lock);
-  if (!c->root_access && c->disk_usage + 1 > c->disk_limit)
+  if (cdiskfull(c, 1))
   {
     printf("kernel: container <%s> memory limit reached. Used: <%d> Limit: <%d>", c->name, c->disk_usage, c->disk_limit);
-    release(&c->lock);
     panic("balloc: Container memory limit reached!\n");
   }
-  release(&c->lock);
 
   bp = 0;
   for(b = 0; b < sb.size; b += BPB){
@@ -87,9 +84,7 @@ balloc(uint dev)
       if((bp->data[bi/8] & m) == 0)
       {  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
-        acquire(&c->lock);
-        c->disk_usage += 1;
-        release(&c->lock);
+        cusage(&c->disk_usage, 1);
         log_write(bp);
         brelse(bp);
         bzero(dev, b + bi);
@@ -117,9 +112,7 @@ bfree(int dev, uint b)
     panic("freeing free block");
 
   c = mycontainer();
-  acquire(&c->lock);
-  if (c->disk_usage > 0) c->disk_usage -= 1;
-  release(&c->lock);
+  cusage(&c->disk_usage, -1);
 
   bp->data[bi/8] &= ~m;
   log_write(bp);
@@ -291,6 +284,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
   release(&icache.lock);
 
   return ip;
@@ -428,6 +422,29 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Return the disk block address of the nth block in inode ip,
+// or 0 if it has none. Unlike bmap, never allocates.
+static uint
+bmapread(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT){
+    if((addr = ip->addrs[NDIRECT]) == 0)
+      return 0;
+    bp = bread(ip->dev, addr);
+    addr = ((uint*)bp->data)[bn];
+    brelse(bp);
+    return addr;
+  }
+  return 0;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -475,6 +492,56 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+#define RAMIN  4  // first readahead window, in blocks
+#define RAMAX 32  // largest readahead window
+
+// Sequential readahead for a readi() of blocks bn through last
+// of ip. Reads that pick up where the last one left off double
+// the window, up to RAMAX; reading more of the last block
+// leaves it alone, and any other read closes it. Starts reading
+// the blocks after bn up to the window past last, without
+// waiting for them, so that the disk works on them while
+// readi() copies out, and the next sequential readi() finds
+// them cached. Only the block map is read with the inode lock
+// held; the prefetches complete without it.
+static void
+readahead(struct inode *ip, uint bn, uint last)
+{
+  uint b, end, addr;
+
+  if(bn == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = RAMIN;
+    else if(ip->rawin < RAMAX)
+      ip->rawin *= 2;
+  } else if(bn + 1 != ip->ranext){
+    // neither the next block nor more of the last one.
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+
+  // top the window up once half of it has been consumed,
+  // rather than a block at a time.
+  end = last + 1 + ip->rawin;
+  if(end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  b = bn + 1;
+  if(ip->raend > b){
+    if(ip->raend >= last + 1 + ip->rawin / 2)
+      end = last + 1;
+    b = ip->raend;
+  }
+  bplug(ip->dev);
+  for(; b < end; b++){
+    if((addr = bmapread(ip, b)) == 0 || breadahead(ip->dev, addr) < 0)
+      break;
+  }
+  bunplug(ip->dev);
+  if(b > ip->raend)
+    ip->raend = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -489,6 +556,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -654,15 +723,17 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
   struct container *c;
-  char correctedpath[MAXPATH] = { 0 };
+  char correctedpath[MAXPATH] = { 0 }, rootpath[MAXPATH];
+  uint rootinum;
 
   c = mycontainer();
+  rootinum = croot(c, rootpath);
 
   if (!c->root_access && strncmp(path, "..", 2) != 0)
   {
-    int stringlength = strlen(c->rootpath);
-    if (c->rootpath[stringlength-1] != '/') c->rootpath[stringlength-1] = '/';
-    safestrcpy(correctedpath, c->rootpath, MAXPATH);
+    int stringlength = strlen(rootpath);
+    if (rootpath[stringlength-1] != '/') rootpath[stringlength-1] = '/';
+    safestrcpy(correctedpath, rootpath, MAXPATH);
     if(*path == '/') path++;
     safestrcpy(correctedpath + stringlength, path, MAXPATH);
     path = correctedpath;
@@ -673,7 +744,7 @@ namex(char *path, int nameiparent, char *name)
   else
     ip = idup(myproc()->cwd);
 
-  if (!c->root_access && strncmp(path, "..", 2) == 0 && c->rootdir->inum == ip->inum) return ip;
+  if (!c->root_access && strncmp(path, "..", 2) == 0 && rootinum == ip->inum) return ip;
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -682,7 +753,7 @@ namex(char *path, int nameiparent, char *name)
       return 0;
     }
 
-    if(strncmp(path, "..", 2) == 0 && c->rootdir->inum == ip->inum && *skipelem(path, name) != '\0') {
+    if(strncmp(path, "..", 2) == 0 && rootinum == ip->inum && *skipelem(path, name) != '\0') {
       iunlock(ip);
       return ip;
     }
@@ -50,6 +50,15 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
+// Most blocks an FS operation adds to the log, for begin_op().
+// Allocating or freeing blocks may write any bitmap block.
+#define LOGBITMAP      (FSSIZE/BPB + 1)
+#define LOGOP_IPUT     (1 + LOGBITMAP)  // iput() that frees: inode, bitmap
+#define LOGOP_UNLINK   (3 + LOGBITMAP)  // dir block, dir and file inodes, iput()
+#define LOGOP_LINK     (4 + LOGBITMAP)  // dir block and indirect, dir and file inodes
+#define LOGOP_CREATE   (5 + LOGBITMAP)  // new inode and its first block, a link
+#define LOGOP_WRITE(n) ((n) + 2 + LOGBITMAP) // n data blocks, indirect, inode
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -0,0 +1,155 @@
+// Futexes: sleep until a word of user memory is changed by
+// someone who then calls futex_wake().
+//
+// Waiters are keyed by the physical address of the word, so
+// threads sharing an address space, or anything else mapping
+// the same page, meet in the same place. Waiters hang off one
+// of NBUCKET hashed lists, each with its own lock, and sleep
+// on their own futexwaiter, so futexwake() can wake exactly n
+// of them, oldest first.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "timer.h"
+
+#define NBUCKET 64
+#define HASH(pa) (((pa) >> 2) % NBUCKET)
+
+struct futexbucket {
+  struct spinlock lock;
+  struct list waiters;  // futexwaiters, newest first
+};
+
+struct futexwaiter {
+  struct list link;     // on a bucket's waiters; must be first
+  uint64 pa;            // physical address waited on
+  struct proc *p;
+  int woken;            // set by futexwake()
+  struct futexbucket *b;
+};
+
+struct futexbucket buckets[NBUCKET];
+
+void
+futexinit(void)
+{
+  struct futexbucket *b;
+
+  for(b = buckets; b < &buckets[NBUCKET]; b++){
+    initlock(&b->lock, "futex");
+    lst_init(&b->waiters);
+  }
+}
+
+// Physical address of the int at user address addr,
+// or 0 if it isn't mapped or isn't aligned.
+static uint64
+futexkey(uint64 addr)
+{
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  if((pa = walkaddr(myproc()->pagetable, PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return pa + (addr - PGROUNDDOWN(addr));
+}
+
+// the timeout of a futexwait() ran out.
+static void
+futextimeout(struct timer *t)
+{
+  struct futexwaiter *fw = t->arg;
+
+  // with fw->b->lock held, fw->p is either still checking
+  // t->pending or already asleep.
+  acquire(&fw->b->lock);
+  wakeupproc(fw->p, fw);
+  release(&fw->b->lock);
+}
+
+// If the int at user address addr still holds val, sleep
+// until futexwake() on it, or for at most nsec nanoseconds
+// if nsec isn't 0. Returns 0 if woken by futexwake(), -1 if
+// the value differed, the time ran out, or p was killed.
+int
+futexwait(uint64 addr, int val, uint64 nsec)
+{
+  struct proc *p = myproc();
+  struct futexwaiter fw;
+  struct futexbucket *b;
+  struct timer t;
+  uint64 pa;
+  int r;
+
+  if((pa = futexkey(addr)) == 0)
+    return -1;
+  b = &buckets[HASH(pa)];
+  fw.pa = pa;
+  fw.p = p;
+  fw.woken = 0;
+  fw.b = b;
+
+  t.w = 0;
+  t.pending = 0;
+  if(nsec != 0){
+    t.expires = mtime() + (nsec * (CLINT_FREQ / 1000000) + 999) / 1000;
+    t.fn = futextimeout;
+    t.arg = &fw;
+    timeradd(&t);
+  }
+
+  // futexwake() takes b->lock too, so the value can't change
+  // and be followed by a wakeup between the check and the sleep.
+  acquire(&b->lock);
+  if(__atomic_load_n((int*)pa, __ATOMIC_SEQ_CST) != val){
+    release(&b->lock);
+    timerdel(&t);
+    return -1;
+  }
+  lst_push(&b->waiters, &fw);
+  while(!fw.woken && (nsec == 0 || t.pending) && !p->killed)
+    sleep(&fw, &b->lock);
+  if(!fw.woken)
+    lst_remove(&fw.link);
+  r = fw.woken ? 0 : -1;
+  release(&b->lock);
+
+  timerdel(&t);
+  return r;
+}
+
+// Wake up to n processes waiting on the int at user
+// address addr. Returns how many were woken, or -1.
+int
+futexwake(uint64 addr, int n)
+{
+  struct futexbucket *b;
+  struct futexwaiter *fw;
+  struct list *e, *prev;
+  uint64 pa;
+  int woken;
+
+  if((pa = futexkey(addr)) == 0)
+    return -1;
+  b = &buckets[HASH(pa)];
+  woken = 0;
+  acquire(&b->lock);
+  for(e = b->waiters.prev; e != &b->waiters && woken < n; e = prev){
+    prev = e->prev;
+    fw = (struct futexwaiter*)e;
+    if(fw->pa != pa)
+      continue;
+    lst_remove(e);
+    fw->woken = 1;
+    wakeupproc(fw->p, fw);
+    woken++;
+  }
+  release(&b->lock);
+  return woken;
+}
@@ -41,15 +41,14 @@ freerange(void *pa_start, void *pa_end)
     kfree(p);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
-void
-kfree(void *pa)
+#define KCACHERESERVE 256 // free pages kernel caches may not take
+#define KRECLAIM       32 // pages to take back from caches at once
+
+// Put page pa back on the free list.
+static void
+freepage(void *pa)
 {
   struct run *r;
-  struct container *c;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
@@ -64,54 +63,86 @@ kfree(void *pa)
   kmem.freelist = r;
   kmem.nfree++;
   release(&kmem.lock);
+}
+
+// Take a page off the free list, or return 0 if there are
+// no more than reserve left.
+static void*
+takepage(uint64 reserve)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = 0;
+  if(kmem.nfree > reserve){
+    r = kmem.freelist;
+    kmem.freelist = r->next;
+    kmem.nfree--;
+  }
+  release(&kmem.lock);
+
+  if(r)
+    memset((char*)r, 5, PGSIZE); // fill with junk
+  return (void*)r;
+}
+
+// Free the page of physical memory pointed at by v,
+// which normally should have been returned by a
+// call to kalloc().  (The exception is when
+// initializing the allocator; see kinit above.)
+void
+kfree(void *pa)
+{
+  struct container *c;
+
+  freepage(pa);
 
   c = mycontainer();
-  acquire(&c->lock);
-  if(c->mem_usage > 0) c->mem_usage -= 1;
-  release(&c->lock);
+  cusage(&c->mem_usage, -1);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, takes pages back from the
+// buffer cache before giving up.
 void *
 kalloc(void)
 {
-  int allocated;
-  struct run *r;
+  void *pa;
   struct container *c;
 
   c = mycontainer();
 
-  acquire(&c->lock);
-  if (!c->root_access && c->mem_usage + 1 > c->mem_limit)
-  {
-    release(&c->lock);
+  if (cmemfull(c, 1))
     panic("out of memory to kalloc\n");
-  }
-  release(&c->lock);
 
-  allocated = 0;
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    kmem.freelist = r->next;
-    kmem.nfree--;
-    allocated++;
-  }
-  release(&kmem.lock);
+  while((pa = takepage(0)) == 0)
+    if(bshrink(KRECLAIM) == 0)
+      break;
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if (pa)
+    cusage(&c->mem_usage, 1);
 
-  if (allocated)
-  {
-    acquire(&c->lock);
-    c->mem_usage++;
-    release(&c->lock);
-  }
+  return pa;
+}
 
-  return (void*)r;
+// Allocate a page for a kernel cache, such as the buffer
+// cache, that gives its pages back through kalloc() when
+// memory runs out. The page is charged to no container, and
+// refused while free memory is low, so that caches only grow
+// into memory no one else wants.
+void *
+kcachealloc(void)
+{
+  return takepage(KCACHERESERVE);
+}
+
+// Free a page from kcachealloc().
+void
+kcachefree(void *pa)
+{
+  freepage(pa);
 }
 
 uint64
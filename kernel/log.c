@@ -2,7 +2,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -16,10 +18,25 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end, telling begin_op() the most blocks it
+// may add to the log (see LOGOP_* in fs.h). Usually begin_op()
+// just reserves them and returns. But if the log doesn't have
+// that many blocks free, besides those reserved by the other
+// in-progress FS system calls, or the transaction has been
+// open for COMMITMS, it sleeps until the last outstanding
+// end_op() commits. A call's blocks that are already in the
+// transaction don't use up its reservation, and end_op()
+// gives back what is left.
+//
+// Commits are pipelined. The committing end_op() copies the
+// transaction's blocks into snapshot buffers of the log's own,
+// after which the next transaction can start while the
+// snapshots are written to the log and the header. The
+// snapshots are then written to their home locations without
+// waiting (checkpointing), and the next commit waits for those
+// writes and clears the header before it reuses the log. While
+// one transaction commits, the ops of the next pile up in it,
+// so that they commit as a group.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +45,7 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The blocks of one append are written concurrently.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,10 +58,20 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // most blocks in a transaction.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks they may yet add to lh.
+  int committing;  // a commit() is running.
+  int snapping;    // taking snapshots of lh, please wait.
+  uint64 topen;    // mtime() when lh got its first block.
   int dev;
-  struct logheader lh;
+  struct logheader lh; // the open transaction
+
+  // the committed transaction, which is in the log on disk
+  // until its checkpoint is done. only commit() uses these.
+  struct logheader clh;
+  struct buf *cached[LOGSIZE]; // its blocks in the cache, pinned
+  struct buf snap[LOGSIZE];    // their contents when it committed
 };
 struct log log[NDISK];
 
@@ -60,24 +87,49 @@ initlog(int dev, struct superblock *sb)
   initlock(&log[dev].lock, "log");
   log[dev].start = sb->logstart;
   log[dev].size = sb->nlog;
+  log[dev].cap = sb->nlog - 1; // less the header
+  if (log[dev].cap > LOGSIZE)
+    log[dev].cap = LOGSIZE;
+  if (log[dev].cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log[dev].dev = dev;
+  for (int i = 0; i < LOGSIZE; i++)
+    log[dev].snap[i].dev = dev;
   recover_from_log(dev);
 }
 
-// Copy committed blocks from log to their home location
+// home writes install_trans() has in flight at once, so that it
+// holds few buffers even if the cache can't grow.
+#define NINSTALL 8
+
+// Copy committed blocks from log to their home location.
+// The writes of each batch of NINSTALL are started before any
+// is waited for, and plugged, so that runs of adjacent blocks
+// go as one request.
+// Only for recovery; commit() checkpoints from its snapshots.
 static void
 install_trans(int dev)
 {
-  int tail;
+  int tail, i, n;
+  struct buf *dbuf[NINSTALL];
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *lbuf = bread(dev, log[dev].start+tail+1); // read log block
-    struct buf *dbuf = bread(dev, log[dev].lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log[dev].lh.n; tail += n) {
+    n = log[dev].lh.n - tail;
+    if (n > NINSTALL)
+      n = NINSTALL;
+    bplug(dev);
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(dev, log[dev].start+tail+i+1); // read log block
+      dbuf[i] = bcreate(dev, log[dev].lh.block[tail+i]); // dst, overwritten
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+      bwrite_async(dbuf[i]);  // write dst to disk
+    }
+    bunplug(dev);
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -95,18 +147,18 @@ read_head(int dev)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the log header lh to disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction in it commits.
 static void
-write_head(int dev)
+write_head(int dev, struct logheader *lh)
 {
   struct buf *buf = bread(dev, log[dev].start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log[dev].lh.n;
-  for (i = 0; i < log[dev].lh.n; i++) {
-    hb->block[i] = log[dev].lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -118,22 +170,34 @@ recover_from_log(int dev)
   read_head(dev);
   install_trans(dev); // if committed, copy from log to disk
   log[dev].lh.n = 0;
-  write_head(dev); // clear the log
+  write_head(dev, &log[dev].lh); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call, which may add
+// up to n blocks to the log.
 void
-begin_op(int dev)
+begin_op(int dev, int n)
 {
+  if(n > log[dev].cap)
+    n = log[dev].cap;
+
   acquire(&log[dev].lock);
   while(1){
-    if(log[dev].committing){
+    if(log[dev].snapping){
       sleep(&log, &log[dev].lock);
-    } else if(log[dev].lh.n + (log[dev].outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log[dev].lh.n + log[dev].reserved + n > log[dev].cap){
+      // this op might exhaust log space; wait for commit,
+      // or for other ops to give back their reservations.
+      sleep(&log, &log[dev].lock);
+    } else if(log[dev].lh.n > 0 &&
+              mtime() - log[dev].topen > COMMITMS * (CLINT_FREQ / 1000)){
+      // the transaction has been open long enough; let it
+      // drain and commit.
       sleep(&log, &log[dev].lock);
     } else {
       log[dev].outstanding += 1;
+      log[dev].reserved += n;
+      myproc()->logres = n;
       release(&log[dev].lock);
       break;
     }
@@ -141,23 +205,27 @@ begin_op(int dev)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless another commit is under way, which then commits
+// this transaction too.
 void
 end_op(int dev)
 {
   int do_commit = 0;
+  struct proc *p = myproc();
 
   acquire(&log[dev].lock);
   log[dev].outstanding -= 1;
-  if(log[dev].committing)
-    panic("log[dev].committing");
-  if(log[dev].outstanding == 0){
+  log[dev].reserved -= p->logres;
+  p->logres = 0;
+  if(log[dev].snapping)
+    panic("log[dev].snapping");
+  if(log[dev].outstanding == 0 && !log[dev].committing){
     do_commit = 1;
     log[dev].committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log[dev].outstanding has decreased
-    // the amount of reserved space.
+    // and this op's unused reservation has been given back.
     wakeup(&log);
   }
   release(&log[dev].lock);
@@ -166,39 +234,111 @@ end_op(int dev)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit(dev);
-    acquire(&log[dev].lock);
-    log[dev].committing = 0;
-    wakeup(&log);
-    release(&log[dev].lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Wait for the checkpoint of the last committed transaction,
+// and erase it from the log, which can then be reused.
 static void
-write_log(int dev)
+finish_checkpoint(int dev)
 {
   int tail;
 
+  if (log[dev].clh.n == 0)
+    return;
+  for (tail = 0; tail < log[dev].clh.n; tail++) {
+    bwait(&log[dev].snap[tail]);
+    bunpin(log[dev].cached[tail]);
+  }
+  log[dev].clh.n = 0;
+  write_head(dev, &log[dev].clh);
+}
+
+// Copy the open transaction's blocks from the cache to the
+// snapshots, and make it the committed one.
+static void
+snapshot(int dev)
+{
+  int tail;
+
+  log[dev].clh.n = log[dev].lh.n;
   for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *to = bread(dev, log[dev].start+tail+1); // log block
     struct buf *from = bread(dev, log[dev].lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(log[dev].snap[tail].data, from->data, BSIZE);
+    log[dev].clh.block[tail] = log[dev].lh.block[tail];
+    log[dev].cached[tail] = from; // stays pinned till checkpointed
     brelse(from);
-    brelse(to);
   }
+  log[dev].lh.n = 0;
 }
 
+// Write the snapshots to the log, then the header, then start
+// writing them home, for finish_checkpoint() to wait for. All
+// the writes of each step are started before any is waited
+// for, and plugged, so that the log goes to disk in a few
+// large requests.
+static void
+write_log(int dev)
+{
+  int tail;
+
+  bplug(dev);
+  for (tail = 0; tail < log[dev].clh.n; tail++)
+    bwrite_at(&log[dev].snap[tail], log[dev].start+tail+1); // write the log
+  bunplug(dev);
+  for (tail = 0; tail < log[dev].clh.n; tail++)
+    bwait(&log[dev].snap[tail]);
+
+  write_head(dev, &log[dev].clh); // the real commit
+
+  bplug(dev);
+  for (tail = 0; tail < log[dev].clh.n; tail++)
+    bwrite_at(&log[dev].snap[tail], log[dev].clh.block[tail]); // checkpoint
+  bunplug(dev);
+}
+
+// is the open transaction finished, and not yet committed?
+// caller holds log[dev].lock.
+static int
+ready(int dev)
+{
+  return log[dev].outstanding == 0 && log[dev].lh.n > 0;
+}
+
+// Commit the open transaction, and any that finishes while
+// doing so. Called with committing set; returns once they
+// are in the log, leaving the last one's checkpoint running.
 static void
 commit(int dev)
 {
-  if (log[dev].lh.n > 0) {
-    write_log(dev);     // Write modified blocks from cache to log
-    write_head(dev);    // Write header to disk -- the real commit
-    install_trans(dev); // Now install writes to home locations
-    log[dev].lh.n = 0;
-    write_head(dev);    // Erase the transaction from the log
+  while(1){
+    acquire(&log[dev].lock);
+    if(!ready(dev))
+      break;
+    release(&log[dev].lock);
+
+    finish_checkpoint(dev); // the log must be free for this one
+
+    // ops may have started meanwhile, in which case the last
+    // of them to end commits.
+    acquire(&log[dev].lock);
+    if(!ready(dev))
+      break;
+    log[dev].snapping = 1;
+    release(&log[dev].lock);
+
+    snapshot(dev);
+
+    acquire(&log[dev].lock);
+    log[dev].snapping = 0;
+    wakeup(&log); // the next transaction can start
+    release(&log[dev].lock);
+
+    write_log(dev); // Write snapshots to log, header, home
   }
+  log[dev].committing = 0;
+  wakeup(&log);
+  release(&log[dev].lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -214,9 +354,10 @@ void
 log_write(struct buf *b)
 {
   int i;
+  struct proc *p = myproc();
 
   int dev = b->dev;
-  if (log[dev].lh.n >= LOGSIZE || log[dev].lh.n >= log[dev].size - 1)
+  if (log[dev].lh.n >= log[dev].cap)
     panic("too big a transaction");
   if (log[dev].outstanding < 1)
     panic("log_write outside of trans");
@@ -229,9 +370,26 @@ log_write(struct buf *b)
   log[dev].lh.block[i] = b->blockno;
   if (i == log[dev].lh.n) {  // Add new block to log?
     bpin(b);
-    log[dev].lh.n++;
+    if (log[dev].lh.n++ == 0)
+      log[dev].topen = mtime();
+    if (p->logres > 0) {  // now in lh rather than reserved
+      p->logres--;
+      log[dev].reserved--;
+    }
   }
   release(&log[dev].lock);
 }
 
+// The most bytes a write op should cover, at any offset, so
+// that it reserves no more than half of dev's log, leaving the
+// rest for other ops.
+int
+log_writebytes(int dev)
+{
+  int n;
 
+  n = log[dev].cap / 2 - LOGOP_WRITE(0) - 1;
+  if (n < 1)
+    n = 1;
+  return n * BSIZE;
+}
@@ -26,6 +26,8 @@ main()
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    timerwheelinit(); // per-hart timer wheels
+    futexinit();     // futex hash buckets
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
@@ -34,6 +36,7 @@ main()
     fileinit();      // file table
     virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
     userinit();      // first user process //set up first container
+    cpuonline();     // start taking processes
     __sync_synchronize();
     started = 1;
   } else {
@@ -44,6 +47,7 @@ main()
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
+    cpuonline();      // start taking processes
   }
   
   scheduler();        
@@ -28,8 +28,10 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_FREQ 10000000L // mtime cycles per second in qemu.
 
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
@@ -54,6 +56,8 @@
 
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
+// slots are handed out as procs are created (see procgrow()),
+// and a slot is only backed by a page while its proc is in use.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
 // User memory layout.
@@ -63,6 +67,9 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   THREADFRAME(NTHREAD-1) .. THREADFRAME(1) (other threads' p->tf)
 //   TRAPFRAME (p->tf, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(n) (TRAPFRAME - (n)*PGSIZE)
+#define MAXUVA THREADFRAME(NTHREAD) // the heap stops below the thread frames
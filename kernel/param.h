@@ -1,6 +1,10 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // max processes reported in a ptable/ctable snapshot
 #define NCONTAINERS   4  // maximum number of containers
-#define PROCLIMIT    16  // maximum number of processes a container may contain
+#define PROCLIMIT   512  // default max number of processes a container may contain
+#define NTHREAD      16  // max threads sharing one address space
+#define NVMSPACE     64  // max multithreaded processes
+#define CWEIGHT    1024  // default container weight for load balancing
+#define RTMAXUTIL   800  // thousandths of a hart real-time containers may reserve
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -8,9 +12,13 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       0  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  10  // max # of blocks any FS op but a write reserves
+#define LOGSIZE      62  // max data blocks in on-disk log
+#define FSLOGSIZE    (MAXOPBLOCKS*3)  // blocks in the log mkfs makes, by default
+#define COMMITMS     10  // longest a transaction takes new ops, in ms
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*3)  // buffers the disk block cache starts with, above what the log pins
+#define BCACHEPCT    10  // percent of RAM the disk block cache may grow into
+#define CBUFPCT      50  // default percent of the disk block cache a container may fill
 #define FSSIZE       2000  // size of file system in blocks
 #define CDISKDEFAULT (FSSIZE/4) // default container disk limit
 #define TOTALPAGES   (PHYSTOP/PGSIZE) //2gb
@@ -20,4 +28,6 @@
 #define CNAME        32
 #define NDISK        2
 #define NNETIF       2
-#define NVC          4   // max number virtual consoles
\ No newline at end of file
+#define NVC          4   // max number virtual consoles
+#define HZ           10  // default clock ticks per second
+#define LOCKSTAT      1  // compile in lock statistics, switched on by ntas(0)
\ No newline at end of file
@@ -8,19 +8,41 @@
 #include "file.h"
 #include "proc.h"
 #include "defs.h"
+#include "timer.h"
 #include "resume_header.h"
 
 #define ROOT 0
+#define ALLCPUS ((1L << NCPU) - 1) // affinity mask allowing every hart
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// struct procs are carved out of whole pages on demand and linked
+// onto proclist. they are never unlinked or freed, only recycled
+// through the UNUSED state, so a struct proc * stays valid forever
+// and the list can be walked without holding proclist_lock.
+struct proc *proclist;
+struct spinlock proclist_lock;
+static int nkstack; // kernel stack slots handed out so far
+
+// kernel stacks are mapped into the kernel page table when a proc
+// is allocated and unmapped when it is reaped. harts compare their
+// cpu->kstackgen against this before switching to a process and
+// flush their TLB if a stack mapping has changed in the meantime.
+struct spinlock kstack_lock;
+static uint kstackgen;
+
 struct proc *initproc;
 
+// address spaces of multithreaded processes.
+struct vmspace vmspaces[NVMSPACE];
+
 struct container containers[NCONTAINERS]; //array of containers
+static struct spinlock rt_lock; // serializes real-time admission control
+static struct rwlock cnames; // containers' names, root paths and root dirs
 struct container *active_container; //active container running
 static int active_idx; //supposed to be used for switching like the console
 static int creation_quantum; //creation quantum(tracker) for containers for cstart
+static uint64 cpusonline; //harts that have come up, one bit per hart
 /** Note:
 => container(zero)- C('Q')
 => container(one)- C('W')
@@ -33,6 +55,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
+static void vmput(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -57,6 +80,96 @@ mycontainer()
   return p? p->container : &containers[ROOT];
 }
 
+// Add delta to one of a container's usage counters, without
+// letting it go below zero. Lock-free, so that kalloc() and
+// balloc() on many harts don't serialize on the container.
+void
+cusage(int *ctr, int delta)
+{
+  int old, new;
+
+  do {
+    old = *(volatile int*)ctr;
+    new = old + delta;
+    if(new < 0)
+      new = 0;
+  } while(!__sync_bool_compare_and_swap(ctr, old, new));
+}
+
+// Would n more pages put container c over its memory limit?
+int
+cmemfull(struct container *c, int n)
+{
+  uint s;
+  int full;
+
+  do {
+    s = read_seqbegin(&c->cfg);
+    full = !c->root_access && c->mem_usage + n > c->mem_limit;
+  } while(read_seqretry(&c->cfg, s));
+  return full;
+}
+
+// Would one more process, bringing n pages of memory, put
+// container c over its process or memory limit?
+int
+cprocfull(struct container *c, int n)
+{
+  uint s;
+  int full;
+
+  do {
+    s = read_seqbegin(&c->cfg);
+    full = !c->root_access && (c->mem_usage + n > c->mem_limit ||
+                               c->proc_count + 1 > c->proc_limit);
+  } while(read_seqretry(&c->cfg, s));
+  return full;
+}
+
+// Would n more blocks put container c over its disk limit?
+int
+cdiskfull(struct container *c, int n)
+{
+  uint s;
+  int full;
+
+  do {
+    s = read_seqbegin(&c->cfg);
+    full = !c->root_access && c->disk_usage + n > c->disk_limit;
+  } while(read_seqretry(&c->cfg, s));
+  return full;
+}
+
+// Does container c fill its share of a buffer cache of up to
+// max buffers?
+int
+cbuffull(struct container *c, int max)
+{
+  uint s;
+  int full;
+
+  do {
+    s = read_seqbegin(&c->cfg);
+    full = !c->root_access && c->buf_usage * 100 >= c->buf_limit * max;
+  } while(read_seqretry(&c->cfg, s));
+  return full;
+}
+
+// Copy container c's root path into path, which must have room
+// for MAXPATH bytes, and return the inode number of its root
+// directory, for namex().
+uint
+croot(struct container *c, char *path)
+{
+  uint inum;
+
+  read_acquire(&cnames);
+  safestrcpy(path, c->rootpath, MAXPATH);
+  inum = c->rootdir ? c->rootdir->inum : 0;
+  read_release(&cnames);
+  return inum;
+}
+
 void
 containerinit(void)
 {
@@ -64,19 +177,35 @@ containerinit(void)
   //Set and access the active container
   active_idx = ROOT;
   creation_quantum = ROOT;
+  initlock(&rt_lock, "rt");
+  initrwlock(&cnames, "cnames");
   //initialize
   for(c = containers; c < &containers[NCONTAINERS]; c++)
   {
     initlock(&c->lock, "container");
+    initseqlock(&c->cfg, "container cfg");
     c->state = c != containers? FREE : STARTED;
     c->proc_count = 0;
     c->mem_usage = 0;
     c->disk_usage = 0;
-    c->proc_limit = NPROC;
+    c->buf_usage = 0;
+    c->proc_limit = PROCLIMIT;
     c->disk_limit = c != containers? CDISKDEFAULT : FSSIZE; // 4th of disk size
     c->mem_limit = c != containers? CMEMPGS : (TOTALPAGES); /*TOTALPAGES CMEMLIMIT/ *DEFAULTPGS * PGSIZE CMEMDEFAULT CMEMLIMIT*/  // 16th of memory
+    c->buf_limit = c != containers? CBUFPCT : 100;
     c->cpu_tokens = 0;
     c->scheduler_tokens = 0;
+    c->affinity = ALLCPUS;
+    memset(c->cputime, 0, sizeof(c->cputime));
+    c->weight = CWEIGHT;
+    c->rtruntime = 0;
+    c->rtperiod = 0;
+    c->rtbudget = 0;
+    c->rtdeadline = 0;
+    c->nwakeup = 0;
+    c->wakesum = 0;
+    c->wakemax = 0;
+    memset(&c->sched, 0, sizeof(c->sched));
     c->root_access = c != containers? 0 : 1;
     c->cidx = 0;
     c->current_pid = 0;
@@ -98,38 +227,383 @@ containerinit(void)
 void
 procinit(void)
 {
-  struct proc *p;
   //Set process space
   initlock(&pid_lock, "nextpid");
-  for(p = proc; p < &proc[NPROC]; p++)
-  {
-    // Initialize process lock
+  initlock(&proclist_lock, "proclist");
+  initlock(&kstack_lock, "kstack");
+  for(int i = 0; i < NVMSPACE; i++)
+    initlock(&vmspaces[i].lock, "vmspace");
+  proclist = 0;
+  nkstack = 0;
+  kstackgen = 0;
+  kvminithart();
+}
+
+// Add a page worth of UNUSED procs to proclist.
+// Each new proc gets its own kernel stack slot, which stays
+// with the proc (and so is recycled with it) from then on.
+// Returns 0 on success, -1 if out of memory.
+static int
+procgrow(void)
+{
+  struct proc *chunk, *p;
+  int i, n;
+
+  if((chunk = (struct proc *)kalloc()) == 0)
+    return -1;
+  memset(chunk, 0, PGSIZE);
+  n = PGSIZE / sizeof(struct proc);
+
+  acquire(&proclist_lock);
+  for(i = 0; i < n; i++){
+    p = &chunk[i];
     initlock(&p->lock, "proc");
-    // Allocate a page for the process's kernel stack.
-    // Map it high in memory, followed by an invalid
-    // guard page.
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-    p->kstack = va;
-    p->cpu_tokens = 0;
-    p->container = 0;
-    p->pagetable = 0;
-    p->sz = 0;
-    p->pid = 0;
-    p->parent = 0;
-    p->name[0] = 0;
-    p->chan = 0;
-    p->killed = 0;
-    p->xstate = 0;
+    p->kstack = KSTACK(nkstack++);
     p->state = UNUSED;
-    p->tracing = 0;
-    p->assigned = 0;
-    p->cpu_tokens = 0;
   }
-  kvminithart();
+  // link the whole chunk in before publishing it, so that
+  // lock-free walkers never see a half-initialized proc.
+  chunk[n-1].next = proclist;
+  for(i = 0; i < n-1; i++)
+    chunk[i].next = &chunk[i+1];
+  __sync_synchronize();
+  proclist = chunk;
+  release(&proclist_lock);
+  return 0;
+}
+
+// Allocate a page for the process's kernel stack and map it
+// at p->kstack, followed by an invalid guard page.
+// Returns 0 on success, -1 if out of memory.
+static int
+kstackalloc(struct proc *p)
+{
+  char *pa;
+
+  if((pa = kalloc()) == 0)
+    return -1;
+  acquire(&kstack_lock);
+  if(kvmmapstack(p->kstack, (uint64)pa) != 0){
+    release(&kstack_lock);
+    kfree(pa);
+    return -1;
+  }
+  __sync_fetch_and_add(&kstackgen, 1);
+  release(&kstack_lock);
+  return 0;
+}
+
+// Unmap and free p's kernel stack page.
+// The slot itself stays with p for its next use.
+static void
+kstackfree(struct proc *p)
+{
+  acquire(&kstack_lock);
+  kvmunmapstack(p->kstack);
+  __sync_fetch_and_add(&kstackgen, 1);
+  release(&kstack_lock);
+}
+
+// Mark this hart as available to run processes.
+// Called by each hart from main() before scheduler().
+void
+cpuonline(void)
+{
+  __sync_fetch_and_or(&cpusonline, 1L << cpuid());
+}
+
+// The harts a process with affinity mask in container c may
+// run on: its own mask narrowed by its container's. If the two
+// don't overlap, the container's mask wins, and if no allowed
+// hart is online, any hart will do.
+static uint64
+effaffinity(uint64 mask, struct container *c)
+{
+  uint64 m;
+
+  if((m = mask & c->affinity & cpusonline) == 0)
+    m = c->affinity & cpusonline;
+  if(m == 0)
+    m = cpusonline;
+  return m;
+}
+
+static uint64
+procaffinity(struct proc *p)
+{
+  return effaffinity(p->affinity, p->container);
+}
+
+// Work that the harts in mask may take is waiting. Idle harts
+// have stopped their clock tick, so if one of them is allowed,
+// poke it out of wfi with a software interrupt rather than
+// leave the work waiting for a device interrupt; scheduler()
+// will balance() it over.
+static void
+kickidle(uint64 mask)
+{
+  int i, me;
+
+  __sync_synchronize();
+  push_off();
+  me = cpuid();
+  for(i = 0; i < NCPU; i++){
+    if(i != me && (mask & (1L << i)) && cpus[i].idle){
+      *(volatile uint32*)CLINT_MSIP(i) = 1;
+      break;
+    }
+  }
+  pop_off();
+}
+
+// Poke hart h out of wfi if it is idle.
+// Pairs with the idle check in scheduler().
+static void
+kickhart(int h)
+{
+  __sync_synchronize();
+  push_off();
+  if(h != cpuid() && cpus[h].idle)
+    *(volatile uint32*)CLINT_MSIP(h) = 1;
+  pop_off();
+}
+
+// Run queues. Each RUNNABLE process is queued on exactly one
+// hart, p->cpu, and only that hart's scheduler() runs it. A
+// queue is not a list: membership is p->cpu, and each hart
+// keeps just a count and a load, the summed container weights
+// of its queued processes. Both are changed atomically under
+// p->lock so that other harts may read them without locking.
+
+#define BALANCEPERIOD (CLINT_FREQ / 100)  // 10ms between periodic balances
+#define MIGRATIONCOST (CLINT_FREQ / 2000) // left a hart within 0.5ms: cache-hot
+#define BALFAILMAX    4                   // hot-only balances before moving one anyway
+
+static void
+enqueue(struct proc *p, int h)
+{
+  p->cpu = h;
+  p->qweight = p->container ? p->container->weight : CWEIGHT;
+  __sync_fetch_and_add(&cpus[h].nrunnable, 1);
+  __sync_fetch_and_add(&cpus[h].qload, p->qweight);
+}
+
+static void
+dequeue(struct proc *p)
+{
+  __sync_fetch_and_sub(&cpus[p->cpu].nrunnable, 1);
+  __sync_fetch_and_sub(&cpus[p->cpu].qload, p->qweight);
+}
+
+// Load on hart h: its queue plus the process it is running.
+static int
+hartload(int h)
+{
+  struct proc *rp;
+  struct container *rc;
+
+  rp = cpus[h].proc;
+  rc = rp ? rp->container : 0;
+  return cpus[h].qload + (rc ? rc->weight : 0);
+}
+
+// The hart to queue p on: the one it last ran on if that is
+// allowed and has nothing else to do, since p's working set
+// may still be in its caches; otherwise the least loaded
+// allowed hart.
+static int
+placement(struct proc *p)
+{
+  uint64 mask;
+  int i, best, load, bestload;
+
+  mask = procaffinity(p);
+  if((mask & (1L << p->cpu)) && hartload(p->cpu) == 0)
+    return p->cpu;
+  best = p->cpu;
+  bestload = -1;
+  for(i = 0; i < NCPU; i++){
+    if((mask & (1L << i)) == 0)
+      continue;
+    load = hartload(i);
+    if(bestload < 0 || load < bestload){
+      best = i;
+      bestload = load;
+    }
+  }
+  return best;
+}
+
+// Move queued p to a hart it is allowed on.
+// Caller must hold p->lock.
+static void
+requeue(struct proc *p)
+{
+  dequeue(p);
+  enqueue(p, placement(p));
+  kickhart(p->cpu);
+}
+
+// Real-time process p was just queued on hart h. Unless h is
+// idle or already running a real-time process, make it preempt
+// what it runs, so that p's wakeup latency is an interrupt
+// rather than the rest of a clock tick.
+static void
+rtpreempt(int h)
+{
+  struct proc *rp;
+  struct container *rc;
+
+  rp = cpus[h].proc;
+  rc = rp ? rp->container : 0;
+  if(rp == 0 || (rc && rc->rtruntime))
+    return;
+  cpus[h].resched = 1;
+  __sync_synchronize();
+  push_off();
+  if(h == cpuid())
+    w_sip(r_sip() | 2);
+  else
+    *(volatile uint32*)CLINT_MSIP(h) = 1;
+  pop_off();
+}
+
+// Has another hart, or a timer, asked this hart to preempt the
+// running process? Clears the request. Called by devintr().
+int
+needresched(void)
+{
+  return __sync_lock_test_and_set(&mycpu()->resched, 0);
+}
+
+// Make p RUNNABLE, queue it, and wake its hart if idle.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  p->tstamp = mtime(); // start of p's CPU_WAIT time
+  p->woken = 1;
+  enqueue(p, placement(p));
+  kickhart(p->cpu);
+  if(p->container && p->container->rtruntime)
+    rtpreempt(p->cpu);
+}
+
+// Record that p ran lat cycles after being woken up.
+// Caller must hold p->lock.
+static void
+wakestat(struct proc *p, uint64 lat)
+{
+  struct container *c = p->container;
+
+  p->nwakeup++;
+  p->wakesum += lat;
+  if(lat > p->wakemax)
+    p->wakemax = lat;
+  acquire(&c->lock);
+  c->nwakeup++;
+  c->wakesum += lat;
+  if(lat > c->wakemax)
+    c->wakemax = lat;
+  release(&c->lock);
+}
+
+// Pull one process to hart id from the busiest other hart, if
+// that evens out their loads. Called by id's scheduler() every
+// BALANCEPERIOD and before it goes idle. A process that left a
+// hart within MIGRATIONCOST is cache-hot and stays put, unless
+// BALFAILMAX balances in a row have found nothing else to move.
+// Returns 1 if a process was moved.
+static int
+balance(int id)
+{
+  struct cpu *c = &cpus[id];
+  struct proc *p;
+  int i, busiest, load, maxload, diff, hot, moved;
+  uint64 me, now;
+
+  c->nbalance++;
+  me = 1L << id;
+  busiest = -1;
+  maxload = 0;
+  for(i = 0; i < NCPU; i++){
+    if(i == id || cpus[i].nrunnable == 0)
+      continue;
+    if((load = hartload(i)) > maxload){
+      busiest = i;
+      maxload = load;
+    }
+  }
+  if(busiest < 0 || (diff = maxload - hartload(id)) <= 0)
+    return 0;
+
+  now = mtime();
+  hot = moved = 0;
+  for(p = proclist; p != 0 && !moved; p = p->next){
+    if(p->state != RUNNABLE || p->cpu != busiest)
+      continue;
+    acquire(&p->lock);
+    // moving p must not just flip the imbalance around.
+    if(p->state == RUNNABLE && p->cpu == busiest &&
+       (procaffinity(p) & me) && 2*p->qweight <= diff){
+      if(now - p->lastran < MIGRATIONCOST && c->balfail < BALFAILMAX){
+        hot = 1;
+      } else {
+        dequeue(p);
+        enqueue(p, id);
+        p->nmigrate++;
+        __sync_fetch_and_add(&cpus[busiest].nmigrateout, 1);
+        c->nmigratein++;
+        moved = 1;
+      }
+    }
+    release(&p->lock);
+  }
+  if(moved)
+    c->balfail = 0;
+  else if(hot)
+    c->balfail++;
+  return moved;
+}
+
+// Kick an idle hart that may run one of the processes waiting
+// in hart id's queue behind another, so that its balance()
+// pulls it over.
+static void
+balancekick(int id)
+{
+  struct proc *p;
+  struct container *pc;
+  uint64 mask;
+
+  if(cpus[id].nrunnable < 2)
+    return;
+  mask = 0;
+  for(p = proclist; p != 0; p = p->next){
+    // no p->lock here, so take one snapshot of p->container.
+    pc = p->container;
+    if(p->state == RUNNABLE && p->cpu == id && pc)
+      mask |= effaffinity(p->affinity, pc);
+  }
+  kickidle(mask & ~(1L << id));
+}
+
+// Charge the time since p->tstamp to p's clock and its
+// container's, and start the next interval now. Called by
+// the scheduler around swtch() and by the trap code when p
+// crosses between user space and the kernel.
+void
+cpucharge(struct proc *p, int clock)
+{
+  uint64 now, d;
+
+  now = mtime();
+  d = now - p->tstamp;
+  p->tstamp = now;
+  p->cputime[clock] += d;
+  if(p->container)
+    __sync_fetch_and_add(&p->container->cputime[clock], d);
 }
 
 // Must be called with interrupts disabled,
@@ -184,36 +658,51 @@ allocproc(void)
   //struct proc *cp;
   struct container *c;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+  for(;;){
+    for(p = proclist; p != 0; p = p->next) {
+      acquire(&p->lock);
+      if(p->state == UNUSED) {
+        goto found;
+      } else {
+        release(&p->lock);
+      }
     }
+    // no free proc; make some more.
+    if(procgrow() < 0)
+      return 0;
   }
-  return 0;
 
 found:
   c = mycontainer();
-  acquire(&c->lock);
-  if(!c->root_access && c->mem_usage + 5 > c->mem_limit)
+  if(cmemfull(c, 5))
   {
-    release(&c->lock);
+    release(&p->lock);
+    return 0;
+  }
+
+  // Allocate the kernel stack.
+  if(kstackalloc(p) < 0){
+    release(&p->lock);
     return 0;
   }
-  release(&c->lock);
 
   p->pid = allocpid();
   // Allocate a trapframe page.
   if((p->tf = (struct trapframe *)kalloc()) == 0){
-    kfree(p->tf);
+    kstackfree(p);
     release(&p->lock);
     return 0;
   }
 
   // An empty user page table.
-  p->pagetable = proc_pagetable(p);
+  p->tfva = TRAPFRAME;
+  if((p->pagetable = proc_pagetable(p)) == 0){
+    kfree((void*)p->tf);
+    p->tf = 0;
+    kstackfree(p);
+    release(&p->lock);
+    return 0;
+  }
   
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -227,10 +716,18 @@ found:
   p->container = c;
   p->assigned = 1;
   p->cpu_tokens = 0;
+  p->affinity = ALLCPUS;
+  memset(p->cputime, 0, sizeof(p->cputime));
+  p->cpu = cpuid();
+  p->lastran = 0;
+  p->nmigrate = 0;
+  p->woken = 0;
+  p->nwakeup = 0;
+  p->wakesum = 0;
+  p->wakemax = 0;
+  memset(&p->sched, 0, sizeof(p->sched));
   //increase proc count
-  acquire(&c->lock);
-  c->proc_count++;
-  release(&c->lock);
+  cusage(&c->proc_count, 1);
 
   return p;
 }
@@ -248,17 +745,19 @@ freeproc(struct proc *p)
   c = mp->container;
   mp->container = p->container;
 
-  acquire(&p->container->lock);
-  if (p->container->proc_count > 0) p->container->proc_count--;
-  release(&p->container->lock);
+  cusage(&p->container->proc_count, -1);
 
   if(p->tf)
     kfree((void*)p->tf);
   p->tf = 0;
 
-  if(p->pagetable)
+  if(p->vm)
+    vmput(p);
+  else if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
 
+  kstackfree(p);
+
   mp->container = c;
   p->container = 0;
   p->pagetable = 0;
@@ -273,6 +772,75 @@ freeproc(struct proc *p)
   p->tracing = 0;
   p->assigned = 0;
   p->cpu_tokens = 0;
+  p->affinity = 0;
+}
+
+// Turn p's address space into one its threads can share,
+// with p as the thread group's leader.
+// Returns 0 on success, -1 if there's no vmspace free.
+static int
+vmshare(struct proc *p)
+{
+  struct vmspace *vm;
+
+  for(vm = vmspaces; vm < &vmspaces[NVMSPACE]; vm++){
+    acquire(&vm->lock);
+    if(vm->ref == 0){
+      vm->ref = 1;
+      vm->slots = 1; // slot 0 is TRAPFRAME, the leader's
+      vm->leader = p;
+      vm->pagetable = p->pagetable;
+      vm->sz = p->sz;
+      release(&vm->lock);
+      p->vm = vm;
+      return 0;
+    }
+    release(&vm->lock);
+  }
+  return -1;
+}
+
+// Drop p's reference to its shared address space, and free
+// the page table along with the user memory once no thread
+// is left using it. p->tf has already been freed.
+static void
+vmput(struct proc *p)
+{
+  struct vmspace *vm = p->vm;
+
+  acquire(&vm->lock);
+  uvmunmap(vm->pagetable, p->tfva, PGSIZE, 0);
+  vm->slots &= ~(1L << ((TRAPFRAME - p->tfva) / PGSIZE));
+  p->vm = 0;
+  if(--vm->ref == 0){
+    uvmunmap(vm->pagetable, TRAMPOLINE, PGSIZE, 0);
+    uvmfree(vm->pagetable, vm->sz);
+    vm->pagetable = 0;
+    vm->leader = 0;
+    vm->sz = 0;
+  }
+  release(&vm->lock);
+}
+
+// p, a thread group's leader, has reaped its last thread: give
+// it back the shared address space as its own, so that exec(),
+// resume() and shrinking sbrk() work again.
+static void
+vmunshare(struct proc *p)
+{
+  struct vmspace *vm = p->vm;
+
+  acquire(&vm->lock);
+  if(vm->ref == 1){
+    p->sz = vm->sz;
+    p->vm = 0;
+    vm->ref = 0;
+    vm->slots = 0;
+    vm->pagetable = 0;
+    vm->leader = 0;
+    vm->sz = 0;
+  }
+  release(&vm->lock);
 }
 
 // Create a page table for a given process,
@@ -309,8 +877,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
   uvmunmap(pagetable, TRAPFRAME, PGSIZE, 0);
-  if(sz > 0)
-    uvmfree(pagetable, sz);
+  uvmfree(pagetable, sz);
 }
 
 // a user program that calls exec("/init")
@@ -346,29 +913,52 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
   creation_quantum++;
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
+// Grow or shrink user memory by n bytes, and
+// set *oldsz to the size before the change.
 // Return 0 on success, -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint64 *oldsz)
 {
-  uint sz;
+  uint64 sz;
+  struct proc *q;
   struct proc *p = myproc();
-
-  sz = p->sz;
-  if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
+  struct vmspace *vm = p->vm;
+
+  if(vm == 0){
+    sz = p->sz;
+    *oldsz = sz;
+    if(n > 0){
+      if(sz + n > MAXUVA || (sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+        return -1;
+      }
+    } else if(n < 0){
+      sz = uvmdealloc(p->pagetable, sz, sz + n);
     }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    p->sz = sz;
+    return 0;
   }
-  p->sz = sz;
+
+  // threads share the memory, so grow it under vm->lock and
+  // tell them all. shrinking would need the other harts'
+  // TLBs flushed, which xv6 has no way to do; refuse.
+  acquire(&vm->lock);
+  sz = vm->sz;
+  *oldsz = sz;
+  if(n < 0 || (n > 0 && (sz + n > MAXUVA || (sz = uvmalloc(vm->pagetable, sz, sz + n)) == 0))){
+    release(&vm->lock);
+    return -1;
+  }
+  vm->sz = sz;
+  for(q = proclist; q != 0; q = q->next)
+    if(q->vm == vm)
+      q->sz = sz;
+  release(&vm->lock);
   return 0;
 }
 
@@ -383,26 +973,27 @@ fork(void)
   struct container *c;
 
   c = p->container;
-  acquire(&c->lock);
-  if (!c->root_access && (c->mem_usage + (int)(p->sz/PGSIZE) > c->mem_limit || c->proc_count + 1 > c->proc_limit))
-  {
-    release(&c->lock);
+  if (cprocfull(c, p->sz/PGSIZE))
     return -1;
-  }
-  release(&c->lock);
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
+  // Copy user memory from parent to child. if p has threads,
+  // keep them from growing the memory while it's copied.
+  if(p->vm)
+    acquire(&p->vm->lock);
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    if(p->vm)
+      release(&p->vm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  
   np->sz = p->sz;
+  if(p->vm)
+    release(&p->vm->lock);
 
   np->parent = p;
 
@@ -420,15 +1011,194 @@ fork(void)
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  // the child stays on the harts its parent was confined to.
+  np->affinity = p->affinity;
+
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  setrunnable(np);
 
   release(&np->lock);
 
   return pid;
 }
 
+// Create a thread: a new process that shares the caller's
+// address space and starts at user address fn with arg in a0
+// and its stack pointer at stack. It gets copies of the
+// caller's open files, like a fork() child.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct container *c;
+  struct vmspace *vm;
+
+  c = p->container;
+  if (cprocfull(c, 0))
+    return -1;
+  if(p->killed)
+    return -1;
+  if(p->vm == 0 && vmshare(p) < 0)
+    return -1;
+  vm = p->vm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // swap the fresh page table allocproc() made for the shared
+  // one, with np's trapframe in a free THREADFRAME slot.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = 0;
+  acquire(&vm->lock);
+  for(slot = 1; slot < NTHREAD; slot++)
+    if((vm->slots & (1L << slot)) == 0)
+      break;
+  if(slot == NTHREAD ||
+     mappages(vm->pagetable, THREADFRAME(slot), PGSIZE, (uint64)np->tf, PTE_R | PTE_W) != 0){
+    release(&vm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  vm->slots |= 1L << slot;
+  vm->ref++;
+  np->vm = vm;
+  np->pagetable = vm->pagetable;
+  np->sz = vm->sz;
+  np->tfva = THREADFRAME(slot);
+  release(&vm->lock);
+
+  // threads belong to the leader, which reaps any
+  // that are left when it exits.
+  np->parent = vm->leader;
+
+  *(np->tf) = *(p->tf);
+  np->tf->epc = fn;
+  np->tf->a0 = arg;
+  np->tf->sp = stack;
+  np->tf->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->affinity = p->affinity;
+  np->tracing = p->tracing;
+
+  pid = np->pid;
+
+  setrunnable(np);
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// Wait for thread tid of the caller's process to exit, copy
+// its exit status to user address addr (if not 0), and reap
+// it. Returns tid, or -1 if there's no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(p->vm == 0)
+    return -1;
+  for(np = proclist; np != 0; np = np->next)
+    if(np->pid == tid && np->vm == p->vm && np != p && np != p->vm->leader)
+      break;
+  if(np == 0)
+    return -1;
+
+  // the thread's exit() wakes joiners sleeping on it.
+  acquire(&np->lock);
+  for(;;){
+    if(np->pid != tid || np->vm != p->vm){
+      // someone else reaped it first.
+      release(&np->lock);
+      return -1;
+    }
+    if(np->state == ZOMBIE)
+      break;
+    if(p->killed){
+      release(&np->lock);
+      return -1;
+    }
+    sleep(np, &np->lock);
+  }
+  if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate, sizeof(np->xstate)) < 0){
+    release(&np->lock);
+    return -1;
+  }
+  freeproc(np);
+  release(&np->lock);
+  if(p->vm->leader == p)
+    vmunshare(p);
+  return tid;
+}
+
+// The leader p of a thread group is exiting: kill the other
+// threads and reap them, so the group's address space goes
+// away with p.
+static void
+threadsexit(struct proc *p)
+{
+  struct proc *q;
+  int n;
+
+  acquire(&p->lock);
+  for(;;){
+    n = 0;
+    for(q = proclist; q != 0; q = q->next){
+      if(q == p || q->vm != p->vm)
+        continue;
+      acquire(&q->lock);
+      if(q->vm == p->vm){
+        if(q->state == ZOMBIE){
+          freeproc(q);
+        } else {
+          n++;
+          q->killed = 1;
+          if(q->state == SLEEPING || q->state == SUSPENDED)
+            setrunnable(q);
+        }
+      }
+      release(&q->lock);
+    }
+    if(n == 0)
+      break;
+    // an exiting thread wakes its parent, p.
+    sleep(p, &p->lock);
+  }
+  release(&p->lock);
+}
+
+// Wake the threads sleeping in join() on p, which is exiting.
+// Caller holds p->lock and p->parent's lock (held).
+static void
+wakejoiners(struct proc *p, struct proc *held)
+{
+  struct proc *q;
+
+  for(q = proclist; q != 0; q = q->next){
+    if(q == p || q->vm != p->vm)
+      continue;
+    if(q != held)
+      acquire(&q->lock);
+    if(q->state == SLEEPING && q->chan == p)
+      setrunnable(q);
+    if(q != held)
+      release(&q->lock);
+  }
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -436,7 +1206,7 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
+  for(pp = proclist; pp != 0; pp = pp->next){
     // this code uses pp->parent without holding pp->lock.
     // acquiring the lock first could cause a deadlock
     // if pp or a child of pp were also in exit()
@@ -466,6 +1236,10 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // a process takes its threads with it.
+  if(p->vm && p->vm->leader == p)
+    threadsexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -475,7 +1249,7 @@ exit(int status)
     }
   }
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_IPUT);
   iput(p->cwd);
   end_op(ROOTDEV);
   p->cwd = 0;
@@ -511,6 +1285,10 @@ exit(int status)
   // Parent might be sleeping in wait().
   wakeup1(original_parent);
 
+  // and other threads in join().
+  if(p->vm)
+    wakejoiners(p, original_parent);
+
   p->xstate = status;
   p->state = ZOMBIE;
 
@@ -537,11 +1315,12 @@ wait(uint64 addr)
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
+    for(np = proclist; np != 0; np = np->next){
       // this code uses np->parent without holding np->lock.
       // acquiring the lock first would cause a deadlock,
       // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
+      // p's threads are reaped by join() and exit(), not here.
+      if(np->parent == p && (np->vm == 0 || np->vm != p->vm)){
         // np->parent can't change between the check and the acquire()
         // because only the parent changes it, and we're the parent.
         acquire(&np->lock);
@@ -575,6 +1354,164 @@ wait(uint64 addr)
   }
 }
 
+// The schedhist bucket for a time of v cycles.
+static int
+histbucket(uint64 v)
+{
+  int b;
+
+  for(b = 0; v > 1 && b < NSCHEDHIST-1; b++)
+    v >>= 1;
+  return b;
+}
+
+// Record one run of p in its and its container's schedhist:
+// it waited lat cycles to get the hart, then ran for ran.
+// Caller must hold p->lock.
+static void
+schedrecord(struct proc *p, uint64 lat, uint64 ran)
+{
+  struct container *c = p->container;
+  int l, r, vol;
+
+  l = histbucket(lat);
+  r = histbucket(ran);
+  vol = p->state != RUNNABLE;
+  p->sched.runlat[l]++;
+  p->sched.slice[r]++;
+  if(vol)
+    p->sched.nvcsw++;
+  else
+    p->sched.nivcsw++;
+  acquire(&c->lock);
+  c->sched.runlat[l]++;
+  c->sched.slice[r]++;
+  if(vol)
+    c->sched.nvcsw++;
+  else
+    c->sched.nivcsw++;
+  release(&c->lock);
+}
+
+// Switch this hart to p, which the caller has taken from its
+// queue and holds the lock of, until p gives the hart back.
+// Returns the cycles p ran.
+static uint64
+runproc(struct cpu *c, struct proc *p)
+{
+  uint64 start, lat;
+
+  if(c->idle){
+    // back to work; restart the clock tick for
+    // preemption and catch ticks up.
+    c->idle = 0;
+    tickstart();
+    clockintr();
+  }
+  dequeue(p);
+  p->state = RUNNING;
+  c->proc = p;
+  if(c->kstackgen != kstackgen){
+    // a kernel stack was remapped since this hart last
+    // looked; drop any stale translation for p->kstack.
+    c->kstackgen = kstackgen;
+    sfence_vma();
+  }
+  // p waited in the run queue until now, and runs in
+  // the kernel until it next switches back here.
+  lat = mtime() - p->tstamp;
+  if(p->woken){
+    p->woken = 0;
+    wakestat(p, lat);
+  }
+  cpucharge(p, CPU_WAIT);
+  start = p->tstamp;
+  swtch(&c->scheduler, &p->context);
+  cpucharge(p, CPU_SYS);
+  p->lastran = p->tstamp; // just set by cpucharge()
+  c->proc = 0;
+  schedrecord(p, lat, p->lastran - start);
+  return p->lastran - start;
+}
+
+// The real-time container with work queued on this hart (in
+// the queued bitmask), budget left in its period and the
+// earliest deadline, or 0. Starts a new period, with a full
+// budget, for those whose deadline has passed.
+static struct container*
+rtpick(int queued)
+{
+  struct container *c, *rt;
+  uint64 now;
+
+  rt = 0;
+  now = mtime();
+  for(c = containers; c < &containers[NCONTAINERS]; c++){
+    if(c->rtruntime == 0 || (queued & (1 << (c - containers))) == 0)
+      continue;
+    acquire(&c->lock);
+    if(c->state == STARTED && c->rtruntime){
+      if(now >= c->rtdeadline){
+        c->rtdeadline = now + c->rtperiod;
+        c->rtbudget = c->rtruntime;
+      }
+      if(c->rtbudget > 0 && (rt == 0 || c->rtdeadline < rt->rtdeadline))
+        rt = c;
+    }
+    release(&c->lock);
+  }
+  return rt;
+}
+
+static struct timer rttimers[NCPU];
+
+// The running real-time process is out of budget.
+static void
+rtexpire(struct timer *t)
+{
+  mycpu()->resched = 1;
+}
+
+// Run p from a real-time container against the container's
+// budget, and have a timer preempt it when the budget runs
+// out. The hart takes all the budget left while p runs and
+// gives back what p didn't use, so the container can't overrun
+// it; meanwhile its procs on other harts run by the token
+// rule. The time counts against the container's tokens too,
+// so once out of budget it doesn't also get a full share of
+// the token rule.
+static void
+rtrun(struct cpu *c, struct proc *p)
+{
+  struct container *rt = p->container;
+  struct timer *t = &rttimers[c - cpus];
+  uint64 ran, budget, deadline;
+  uint start;
+
+  acquire(&rt->lock);
+  budget = rt->rtbudget;
+  deadline = rt->rtdeadline;
+  rt->rtbudget = 0;
+  release(&rt->lock);
+  if(budget == 0)
+    return; // another hart took it since rtpick()
+
+  t->expires = mtime() + budget;
+  t->fn = rtexpire;
+  t->arg = 0;
+  timeradd(t);
+  start = ticks;
+  ran = runproc(c, p);
+  timerdel(t);
+  acquire(&rt->lock);
+  // give back the rest, unless a new period has begun.
+  if(rt->rtdeadline == deadline)
+    rt->rtbudget = ran < budget ? budget - ran : 0;
+  rt->scheduler_tokens += ticks - start;
+  rt->current_pid = p->pid;
+  release(&rt->lock);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -585,50 +1522,125 @@ wait(uint64 addr)
 void
 scheduler(void)
 {
-  int start;
-  uint tokens;
+  int id, start, runnable, queued, skip;
+  uint tokens, s;
+  uint64 me;
   struct proc* p;
   struct cpu* c = mycpu();
-  struct container* current, *search, *smallest;
+  struct container* current, *search, *smallest, *rt;
   
   c->proc = 0;
+  id = cpuid();
+  me = 1L << id;
+  c->nextbalance = mtime() + BALANCEPERIOD;
   for(;;){
     // Avoid deadlock by giving devices a chance to interrupt.
     intr_on();
+    // the containers with processes in this hart's queue; only
+    // they compete for its scheduler tokens.
+    queued = 0;
+    for(p = proclist; p != 0; p = p->next){
+      search = p->container;
+      if(p->state == RUNNABLE && p->cpu == id && search)
+        queued |= 1 << (search - containers);
+    }
+    rt = rtpick(queued);
     // Run the for loop with interrupts off to avoid
     // a race between an interrupt and WFI, which would
     // cause a lost wakeup.
-    for(p = proc; p < &proc[NPROC]; p++)
+    runnable = 0;
+    for(p = proclist; p != 0; p = p->next)
     {
       acquire(&p->lock);
-      smallest = containers;
-      for (search = containers; search < &containers[NCONTAINERS]; search++)
+      if(p->state != RUNNABLE || p->cpu != id)
+      {
+        // not ours to run.
+        c->intena = 0;
+        release(&p->lock);
+        continue;
+      }
+      if((procaffinity(p) & me) == 0)
       {
-        acquire(&search->lock);
-        if(search->state != STARTED)
+        // p's affinity changed while it waited here.
+        requeue(p);
+        c->intena = 0;
+        release(&p->lock);
+        continue;
+      }
+      runnable = 1;
+      if(rt)
+      {
+        // a real-time container with budget left has work
+        // here; nothing else runs until it is done or out
+        // of budget.
+        if(p->container == rt)
         {
-          release(&search->lock);
-          continue;
+          rtrun(c, p);
+          rt = rtpick(queued);
         }
+        c->intena = 0;
+        release(&p->lock);
+        continue;
+      }
+      smallest = 0;
+      for (search = containers; search < &containers[NCONTAINERS]; search++)
+      {
+        do {
+          s = read_seqbegin(&search->cfg);
+          skip = search->state != STARTED || (search->affinity & me) == 0;
+        } while(read_seqretry(&search->cfg, s));
+        // containers pinned elsewhere, or with nothing
+        // queued here, don't get a turn here.
+        if(skip || (queued & (1 << (search - containers))) == 0)
+          continue;
         tokens = search->scheduler_tokens;
-        release(&search->lock);
-        if(smallest->scheduler_tokens > tokens && tokens != 0) smallest = search;
+        if(tokens != 0 && (smallest == 0 || smallest->scheduler_tokens > tokens)) smallest = search;
       }
       current = smallest;
-      if (p->container == current && p->state == RUNNABLE && current->state == STARTED)
+      if (current && p->container == current && p->state == RUNNABLE && current->state == STARTED)
       {
         current->scheduler_tokens++;
-        p->state = RUNNING;
-        c->proc = p;
         start = ticks;
-        swtch(&c->scheduler, &p->context);
-        c->proc = 0;
+        runproc(c, p);
         current->scheduler_tokens += ticks - start;
         current->current_pid = p->pid;
       }
       c->intena = 0;
       release(&p->lock);
     }
+
+    if(mtime() >= c->nextbalance){
+      c->nextbalance = mtime() + BALANCEPERIOD;
+      balance(id);
+      balancekick(id);
+    }
+
+    if(!runnable && !balance(id)){
+      // nothing to do, here or on a busier hart. stop the clock tick and wait for a
+      // device interrupt, one of this hart's timers, or a
+      // kick from a hart that queued a process here. look
+      // once more after advertising c->idle, so that a
+      // process queued in between is either seen here or
+      // kicked for by kickhart().
+      intr_off();
+      if(!c->idle){
+        c->idle = 1;
+        tickstop();
+      }
+      __sync_synchronize();
+      for(p = proclist; p != 0; p = p->next){
+        // no p->lock here; one queued after the look is
+        // kicked for, and a stale RUNNABLE costs one more pass.
+        if(p->state == RUNNABLE && p->cpu == id)
+          break;
+      }
+      // wfi with interrupts still off: a pending interrupt
+      // wakes it all the same, and is taken at intr_on(), so
+      // none can slip in between the look and the wait.
+      if(p == 0)
+        asm volatile("wfi");
+      intr_on();
+    }
   }
 }
 
@@ -643,7 +1655,7 @@ scheduler(void)
         continue;
       }
       release(&cn->lock);
-      for(p = proc; p < &proc[NPROC]; p++)
+      for(p = proclist; p != 0; p = p->next)
       {
         acquire(&p->lock);
         if (p->container == cn && p->state == RUNNABLE && cn->state == STARTED)
@@ -662,7 +1674,7 @@ scheduler(void)
  * OLD SCHEDULER CODE
     // intr_off();
     // int found = 0;
-  //   for(p = proc; p < &proc[NPROC]; p++) {
+  //   for(p = proclist; p != 0; p = p->next) {
   //     acquire(&p->lock);
   //     if(p->state == RUNNABLE) {
   //       // Switch to chosen process.  It is the process's job
@@ -723,9 +1735,17 @@ sched(void)
 void
 yield(void)
 {
+  int h;
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  // back on this hart's queue, unless p's affinity changed
+  // under it; then hand it to a hart allowed to run it.
+  h = cpuid();
+  if((procaffinity(p) & (1L << h)) == 0)
+    h = placement(p);
+  enqueue(p, h);
+  kickhart(h);
   sched();
   release(&p->lock);
 }
@@ -792,15 +1812,27 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(p = proclist; p != 0; p = p->next) {
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      setrunnable(p);
     }
     release(&p->lock);
   }
 }
 
+// Wake up p if it is sleeping on chan.
+// Must be called without p->lock.
+void
+wakeupproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan) {
+    setrunnable(p);
+  }
+  release(&p->lock);
+}
+
 // Wake up p if it is sleeping in wait(); used by exit().
 // Caller must hold p->lock.
 static void
@@ -809,7 +1841,7 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    setrunnable(p);
   }
 }
 
@@ -823,13 +1855,13 @@ kill(int pid)
   struct proc *mp;
 
   mp = myproc();
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = proclist; p != 0; p = p->next){
     acquire(&p->lock);
     if(p->pid == pid && (mp->container == p->container || mp->container->root_access)){
       p->killed = 1;
       if(p->state == SLEEPING || p->state == SUSPENDED){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -892,7 +1924,7 @@ procdump(void)
   mp = myproc();
   printf("\n");
   printf("PID\tSTATE\tNAME\tCONTAINER\tPROCESS\n");
-  for(p = proc; p < &proc[NPROC]; p++)
+  for(p = proclist; p != 0; p = p->next)
   {
     acquire(&p->lock);
     if(p->state == UNUSED || !p->assigned || (mp && !mp->container->root_access && p->container != mp->container))
@@ -942,8 +1974,8 @@ psinfo(void)
   struct proc *mp; // check myproc to make sure the containers are the same
 
   mp = myproc();
-  printf("PID\tMEM\tNAME\tSTATE\tCONTAINER\n");
-	for(p = proc; p < &proc[NPROC]; p++) {
+  printf("PID\tMEM\tNAME\tSTATE\tCONTAINER\tCPUS\n");
+	for(p = proclist; p != 0; p = p->next) {
     acquire(&p->lock);
     if(p->state == UNUSED || !p->assigned || (!mp->container->root_access && p->container != mp->container))
     {
@@ -952,12 +1984,13 @@ psinfo(void)
     }
     if (mp->container->root_access || p->container == mp->container)
     {
-      printf("%d\t%dK\t%s\t%s\t%s\n", 
+      printf("%d\t%dK\t%s\t%s\t%s\t\t%x\n", 
         p->pid, 
         (int)(p->sz / KILOMEM), 
         p->name,
         states[p->state],
-        p->container->name
+        p->container->name,
+        (int)procaffinity(p)
       );
     }
     release(&p->lock);
@@ -994,13 +2027,15 @@ suspend(int pid, struct file *f)
 	struct resumehdr rhdr; //resume header instead of elf header
   mp = myproc();
 	printf("Finding suspended process:\n");
-	for(p = proc; p < &proc[NPROC]; p++)
+	for(p = proclist; p != 0; p = p->next)
 	{
      	if(!p->assigned || p->pid != pid || (!p->container->root_access && p->container != mp->container))
      		continue;
 		  //suspend process
      	acquire(&p -> lock);
    		printf("Found process and changing it to suspended now.\n");
+   		if(p -> state == RUNNABLE)
+   		  dequeue(p);
    		p -> state = SUSPENDED;
    		//release successfully
    		release(&p -> lock);
@@ -1032,14 +2067,14 @@ createcontainer(void)
 {
   struct container *c;
   for(c = &containers[1]; c < &containers[NCONTAINERS]; c++) {
-    acquire(&c->lock);
+    write_seqlock(&c->cfg);
     if(c->state == FREE || c->state == CREATED || c->state == STOPPED) {
       // Reserve the container.
       c->state = STARTED;
-      release(&c->lock);
+      write_sequnlock(&c->cfg);
       return c;
     }
-    release(&c->lock);
+    write_sequnlock(&c->cfg);
   }
   return 0;
 }
@@ -1048,14 +2083,14 @@ struct container*
 find(char *cname)
 {
   struct container *c;
+  read_acquire(&cnames);
   for(c = containers; c < &containers[NCONTAINERS]; c++) {
-    acquire(&c->lock);
     if(strncmp(c->name, cname, sizeof(c->name)) == 0) {
-      release(&c->lock);
+      read_release(&cnames);
       return c;
     }
-    release(&c->lock);
   }
+  read_release(&cnames);
   return 0;
 }
 
@@ -1071,24 +2106,31 @@ int cinfo(void)
 	  [SUSPENDED] "suspended"
   };
   //variables
-  uint64 total;
+  uint64 total, cycles;
   uint tokens;
   char *state;
   struct proc *p;
   struct container* c;
   total = 0;
   tokens = 0;
-  for(p = proc; p < &proc[NPROC]; p++)
+  for(p = proclist; p != 0; p = p->next)
   {
     if(p->state == UNUSED || !p->assigned)
       continue;
     total += p->cpu_tokens;
     p->container->cpu_tokens += p->cpu_tokens;
   }
+  //cpu % is the share of the cycles run by started containers
+  cycles = 0;
+  for (c = containers; c < &containers[NCONTAINERS]; c++)
+    if (c->state == STARTED)
+      cycles += c->cputime[CPU_USER] + c->cputime[CPU_SYS];
+  if (cycles == 0)
+    cycles = 1;
   printf("Ticks: %d\nTotal Tokens: %d\n", ticks, total);
   printf("[Process Statistics]\n");
   printf("\nPID\tCPU %%\tTOKENS\tSTATE\tNAME\tCONTAINER\n");
-  for(p = proc; p < &proc[NPROC]; p++)
+  for(p = proclist; p != 0; p = p->next)
   {
     if(p->state == UNUSED)
       continue;
@@ -1098,23 +2140,24 @@ int cinfo(void)
       state = "???";
     c = p->container;
     tokens = p->cpu_tokens;
-    printf("%d\t%d\t%d\t%s\t%s\t'%s'\t\n", p->pid, (tokens*100)/total, tokens, state, p->name, c->name);
+    printf("%d\t%d\t%d\t%s\t%s\t'%s'\t\n", p->pid, (int)(((p->cputime[CPU_USER] + p->cputime[CPU_SYS])*100)/cycles), tokens, state, p->name, c->name);
   }
   printf("[Process Statistics]\n");
   printf("\n[Container Statistics]\n");
-  printf("NAME\tMEM(KB)\tDISK\tPROCS\tCPU %%\tTOKENS\n");
+  printf("NAME\tMEM(KB)\tDISK\tPROCS\tCPU %%\tTOKENS\tCPUS\n");
   for (c = containers; c < &containers[NCONTAINERS]; c++)
   {
     acquire(&c->lock);
     if (c->state == STARTED)
     {
-      printf("%s\t%d\t%d\t%d\t%d%%\t%d\n", 
+      printf("%s\t%d\t%d\t%d\t%d%%\t%d\t%x\n", 
         c->name, 
         (c->mem_usage * PGSIZE)/KILOMEM,
         c->disk_usage * KILOMEM,
         c->proc_count,
-        (c->cpu_tokens * 100)/total,
-        c->cpu_tokens
+        (int)(((c->cputime[CPU_USER] + c->cputime[CPU_SYS]) * 100)/cycles),
+        c->cpu_tokens,
+        (int)c->affinity
       );
       c->cpu_tokens = 1;
     }
@@ -1128,9 +2171,9 @@ int cpause(char* cname)
 {
   struct container *c = find(cname);
   if (!c) return -1;
-  acquire(&c->lock);
+  write_seqlock(&c->cfg);
   c->state = PAUSED;
-  release(&c->lock);
+  write_sequnlock(&c->cfg);
   return 1;
 }
 
@@ -1138,15 +2181,23 @@ int cresume(char* cname)
 {
   struct container *c = find(cname);
   if (!c || c->state != PAUSED) return -1;
-  acquire(&c->lock);
+  write_seqlock(&c->cfg);
   c->state = STARTED;
-  release(&c->lock);
+  write_sequnlock(&c->cfg);
+  kickidle(c->affinity);
   return 1;
 }
 
-int cstart(int vcfd, char* vcname, char* cname, char* rootpath, char* program)
+int cstart(int vcfd, char* vcname, char* cname, char* rootpath, char* program, uint64 mask)
 {
   struct inode *ip;
+  if (mask == 0)
+    mask = ALLCPUS;
+  if ((mask & cpusonline) == 0)
+  {
+    printf("no online cpus in the affinity mask\n");
+    return -1;
+  }
   if ((ip = namei(rootpath)) < 0)
   {
     printf("failed to get the rootpath\n");
@@ -1163,26 +2214,39 @@ int cstart(int vcfd, char* vcname, char* cname, char* rootpath, char* program)
   //4 pages: where 2 pages are code + data 
   // and the other 2 pages are for the stack
   int pages = 9; 
-  acquire(&c->lock);
+  write_acquire(&cnames);
   strncpy(c->name, cname, CNAME);
   strncpy(c->vc_name, vcname, CNAME);
   safestrcpy(c->rootpath, rootpath, MAXPATH);
-  c->proc_count++;
-  c->mem_usage += pages;
+  write_release(&cnames);
+  write_seqlock(&c->cfg);
+  c->affinity = mask;
+  c->weight = CWEIGHT;
+  write_sequnlock(&c->cfg);
+  acquire(&c->lock);
+  memset(c->cputime, 0, sizeof(c->cputime));
+  c->rtruntime = 0;
+  c->nwakeup = 0;
+  c->wakesum = 0;
+  c->wakemax = 0;
+  memset(&c->sched, 0, sizeof(c->sched));
   c->scheduler_tokens++;
   release(&c->lock);
+  cusage(&c->proc_count, 1);
+  cusage(&c->mem_usage, pages);
   //update the parent container and stats
   struct proc *p;
   p = myproc();
   p->container = c;
   strncpy(p->name, program, 16);
-  acquire(&p->parent->container->lock); /*parent->*/
-  p->parent->container->proc_count--; /*parent->*/
-  p->parent->container->mem_usage -= pages; /*parent->*/
-  release(&p->parent->container->lock); /*parent->*/
+  cusage(&p->parent->container->proc_count, -1); /*parent->*/
+  cusage(&p->parent->container->mem_usage, -pages); /*parent->*/
   //correct file pointers
-  begin_op(ROOTDEV);
-  c->rootdir = idup(ip);
+  begin_op(ROOTDEV, LOGOP_IPUT);
+  ip = idup(ip);
+  write_acquire(&cnames);
+  c->rootdir = ip;
+  write_release(&cnames);
   iput(p->cwd);
   end_op(ROOTDEV);
   p->cwd = ip;
@@ -1195,7 +2259,7 @@ int cstop(char* cname)
   struct proc *p;
   struct container *c = find(cname);
   if (!c) return -1;
-  for(p = proc; p < &proc[NPROC]; p++)
+  for(p = proclist; p != 0; p = p->next)
   {
     if(p->container == c)
     {
@@ -1203,14 +2267,16 @@ int cstop(char* cname)
       yield();
     }
   }
-  acquire(&c->lock);
+  write_acquire(&cnames);
   *c->name = '\0';
   *c->vc_name = '\0';
   *c->rootpath = '\0';
-  c->proc_count = 0;
-  c->state = STOPPED;
   c->rootdir = 0;
-  release(&c->lock);
+  write_release(&cnames);
+  __sync_lock_test_and_set(&c->proc_count, 0);
+  write_seqlock(&c->cfg);
+  c->state = STOPPED;
+  write_sequnlock(&c->cfg);
   return 1;
 }
 
@@ -1237,4 +2303,278 @@ freememory(void)
   }
   printf("Used memory:  '%d' Pages\n", mem_usage);
   printf("Free memory:  '%d' Pages\n", mem_limit);
-}
\ No newline at end of file
+}
+// Set the affinity mask of process pid, or of the caller if
+// pid is 0. Bit i allows hart i. Returns -1 if no such process
+// is visible to the caller or mask names no online hart.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  struct proc *mp;
+  int move;
+
+  mp = myproc();
+  if ((mask & cpusonline) == 0)
+    return -1;
+  if (pid == 0)
+    pid = mp->pid;
+  for(p = proclist; p != 0; p = p->next){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && (mp->container == p->container || mp->container->root_access)){
+      p->affinity = mask;
+      if(p->state == RUNNABLE && (procaffinity(p) & (1L << p->cpu)) == 0)
+        requeue(p);
+      // move off this hart now if we may no longer run here.
+      move = p == mp && (procaffinity(p) & (1L << cpuid())) == 0;
+      release(&p->lock);
+      if(move)
+        yield();
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Return the affinity mask process pid (0 for the caller)
+// actually runs with, or -1 if there is no such process.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  struct proc *mp;
+  int mask;
+
+  mp = myproc();
+  if (pid == 0)
+    pid = mp->pid;
+  for(p = proclist; p != 0; p = p->next){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && (mp->container == p->container || mp->container->root_access)){
+      mask = procaffinity(p);
+      release(&p->lock);
+      return mask;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Confine every process in container cname to the harts in
+// mask. Only the root container may move containers around.
+int
+csetaffinity(char *cname, uint64 mask)
+{
+  struct container *c;
+
+  if (!myproc()->container->root_access || (mask & cpusonline) == 0)
+    return -1;
+  if (!(c = find(cname)))
+    return -1;
+  write_seqlock(&c->cfg);
+  c->affinity = mask;
+  write_sequnlock(&c->cfg);
+  kickidle(mask);
+  return 1;
+}
+
+// Copy cpu accounting for up to n processes and containers
+// visible to the caller into the cpustat array at user
+// address addr: processes first, then containers (pid 0).
+// Returns the number of entries copied, or -1.
+int
+cpustat(uint64 addr, int n)
+{
+  struct cpustat st;
+  struct proc *p;
+  struct proc *mp;
+  struct container *c;
+  int i;
+
+  mp = myproc();
+  i = 0;
+  for(p = proclist; p != 0 && i < n; p = p->next){
+    acquire(&p->lock);
+    if(p->state == UNUSED || !p->assigned || (!mp->container->root_access && p->container != mp->container)){
+      release(&p->lock);
+      continue;
+    }
+    memset(&st, 0, sizeof(st));
+    st.pid = p->pid;
+    safestrcpy(st.name, p->name, sizeof(st.name));
+    safestrcpy(st.cname, p->container->name, sizeof(st.cname));
+    st.user = p->cputime[CPU_USER];
+    st.sys = p->cputime[CPU_SYS];
+    st.wait = p->cputime[CPU_WAIT];
+    st.nmigrate = p->nmigrate;
+    st.nwakeup = p->nwakeup;
+    st.wakesum = p->wakesum;
+    st.wakemax = p->wakemax;
+    release(&p->lock);
+    if(copyout(mp->pagetable, addr + i*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    i++;
+  }
+  for(c = containers; c < &containers[NCONTAINERS] && i < n; c++){
+    acquire(&c->lock);
+    if((c->state != STARTED && c->state != PAUSED) || (!mp->container->root_access && c != mp->container)){
+      release(&c->lock);
+      continue;
+    }
+    memset(&st, 0, sizeof(st));
+    safestrcpy(st.cname, c->name, sizeof(st.cname));
+    st.user = c->cputime[CPU_USER];
+    st.sys = c->cputime[CPU_SYS];
+    st.wait = c->cputime[CPU_WAIT];
+    st.nwakeup = c->nwakeup;
+    st.wakesum = c->wakesum;
+    st.wakemax = c->wakemax;
+    release(&c->lock);
+    if(copyout(mp->pagetable, addr + i*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
+
+// Set the load balancing weight of container cname's
+// processes, relative to CWEIGHT. Root only. Takes effect
+// as they are next queued.
+int
+csetweight(char *cname, int weight)
+{
+  struct container *c;
+
+  if (!myproc()->container->root_access || weight <= 0 || weight > 64*CWEIGHT)
+    return -1;
+  if (!(c = find(cname)))
+    return -1;
+  write_seqlock(&c->cfg);
+  c->weight = weight;
+  write_sequnlock(&c->cfg);
+  return 1;
+}
+
+// Copy run queue and load balancer state for up to n online
+// harts into the hartstat array at user address addr.
+// Returns the number of entries copied, or -1.
+int
+hartstat(uint64 addr, int n)
+{
+  struct hartstat st;
+  struct proc *rp;
+  struct cpu *c;
+  int i, k;
+
+  k = 0;
+  for(i = 0; i < NCPU && k < n; i++){
+    if((cpusonline & (1L << i)) == 0)
+      continue;
+    c = &cpus[i];
+    memset(&st, 0, sizeof(st));
+    st.hart = i;
+    st.idle = c->idle;
+    rp = c->proc;
+    st.pid = rp ? rp->pid : 0;
+    st.nrunnable = c->nrunnable;
+    st.load = hartload(i);
+    st.nmigratein = c->nmigratein;
+    st.nmigrateout = c->nmigrateout;
+    st.nbalance = c->nbalance;
+    if(copyout(myproc()->pagetable, addr + k*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    k++;
+  }
+  return k;
+}
+
+// Put container cname in the real-time class with a budget of
+// runtime microseconds every period microseconds, or take it
+// out if runtime is 0. Root only, and root itself can't be
+// real-time. Admission control keeps the real-time containers'
+// reservations together under RTMAXUTIL thousandths of one
+// hart, so that ordinary containers, root's included, always
+// have time left on every hart.
+int
+csetrt(char *cname, int runtime, int period)
+{
+  struct container *c, *x;
+  uint64 util;
+
+  if (!myproc()->container->root_access || runtime < 0 || period <= 0 || runtime > period)
+    return -1;
+  if (!(c = find(cname)) || c == rootcontainer())
+    return -1;
+  acquire(&rt_lock);
+  util = (uint64)runtime * 1000 / period;
+  for(x = containers; x < &containers[NCONTAINERS]; x++)
+    if(x != c && x->rtruntime)
+      util += x->rtruntime * 1000 / x->rtperiod;
+  if(runtime > 0 && util > RTMAXUTIL){
+    release(&rt_lock);
+    return -1;
+  }
+  acquire(&c->lock);
+  c->rtperiod = (uint64)period * (CLINT_FREQ / 1000000);
+  c->rtruntime = (uint64)runtime * (CLINT_FREQ / 1000000);
+  c->rtbudget = 0;
+  c->rtdeadline = 0; // starts a period when next picked
+  release(&c->lock);
+  release(&rt_lock);
+  return 1;
+}
+
+// Copy scheduler statistics for up to n processes and
+// containers visible to the caller into the schedstat array at
+// user address addr: processes first, then containers (pid 0).
+// If reset is set, zero the copied statistics, so that the next
+// call sees only what happened since. Returns the number of
+// entries copied, or -1.
+int
+schedstat(uint64 addr, int n, int reset)
+{
+  struct schedstat st;
+  struct proc *p;
+  struct proc *mp;
+  struct container *c;
+  int i;
+
+  mp = myproc();
+  i = 0;
+  for(p = proclist; p != 0 && i < n; p = p->next){
+    acquire(&p->lock);
+    if(p->state == UNUSED || !p->assigned || (!mp->container->root_access && p->container != mp->container)){
+      release(&p->lock);
+      continue;
+    }
+    memset(&st, 0, sizeof(st));
+    st.pid = p->pid;
+    safestrcpy(st.name, p->name, sizeof(st.name));
+    safestrcpy(st.cname, p->container->name, sizeof(st.cname));
+    st.h = p->sched;
+    if(reset)
+      memset(&p->sched, 0, sizeof(p->sched));
+    release(&p->lock);
+    if(copyout(mp->pagetable, addr + i*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    i++;
+  }
+  for(c = containers; c < &containers[NCONTAINERS] && i < n; c++){
+    acquire(&c->lock);
+    if((c->state != STARTED && c->state != PAUSED) || (!mp->container->root_access && c != mp->container)){
+      release(&c->lock);
+      continue;
+    }
+    memset(&st, 0, sizeof(st));
+    safestrcpy(st.cname, c->name, sizeof(st.cname));
+    st.h = c->sched;
+    if(reset)
+      memset(&c->sched, 0, sizeof(c->sched));
+    release(&c->lock);
+    if(copyout(mp->pagetable, addr + i*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
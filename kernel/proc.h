@@ -24,6 +24,18 @@ struct cpu {
   struct context scheduler;   // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint kstackgen;             // kstackgen as of this cpu's last TLB flush.
+  uint64 nexttick;            // last clock tick deadline seen by timerintr().
+  int idle;                   // clock tick stopped by scheduler()?
+  // run queue: the RUNNABLE procs with p->cpu == this hart.
+  int nrunnable;              // number of procs queued here
+  int qload;                  // sum of their p->qweight
+  uint64 nextbalance;         // mtime of the next periodic balance()
+  int balfail;                // balance()s in a row that found only cache-hot procs
+  uint nmigratein;            // procs balance() pulled to this hart
+  uint nmigrateout;           // procs balance() pulled away
+  uint nbalance;              // balance() calls
+  int resched;                // preempt the running process at the next interrupt
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +94,21 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE, SUSPENDED };
 
+// cpu accounting clocks, counted in CLINT mtime cycles
+// (CLINT_FREQ per second) and charged by cpucharge().
+enum cpuclock { CPU_USER, CPU_SYS, CPU_WAIT, NCPUCLOCK };
+
+// scheduler statistics of a process or container. bucket i of
+// a histogram counts times of [2^i, 2^(i+1)) mtime cycles; the
+// last bucket also takes anything longer.
+#define NSCHEDHIST 24
+struct schedhist {
+  uint nvcsw;              // switched out to sleep or exit
+  uint nivcsw;             // switched out still RUNNABLE: preempted or yielded
+  uint runlat[NSCHEDHIST]; // RUNNABLE-to-RUNNING latency
+  uint slice[NSCHEDHIST];  // time run per switch in
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -97,19 +124,57 @@ struct proc {
   int tracing;                 // flag for strace
   int assigned;                // Default until process is assigned
   uint cpu_tokens;             // tokens for the amount cpu used
+  uint64 affinity;             // Harts p may run on, one bit per hart
+  uint64 tstamp;               // mtime when p's current cpuclock started
+  uint64 cputime[NCPUCLOCK];   // cycles spent in each cpuclock
+  int cpu;                     // Hart whose run queue p is on, or last ran on
+  int qweight;                 // Weight p added to cpus[cpu].qload
+  uint64 lastran;              // mtime when p last left a hart
+  uint nmigrate;               // Times balance() moved p between harts
+  int woken;                   // RUNNABLE because of a wakeup, not a yield
+  uint nwakeup;                // wakeups, and their latency to running, in cycles
+  uint64 wakesum;
+  uint64 wakemax;
+  struct schedhist sched;      // Switch counts and histograms, see runproc()
+  struct vmspace *vm;          // Address space shared with threads, or 0
+  uint64 tfva;                 // User virtual address of p->tf
+  // set once when the proc is carved out, then never changed.
+  struct proc *next;           // Next proc in proclist
+  uint64 kstack;               // Virtual address of kernel stack slot
+
   // these are private to the process, so p->lock need not be held.
-  uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // Page table
   struct trapframe *tf;        // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int logres;                  // Log blocks p's FS op reserved and hasn't used
+  struct buf *plug;            // Disk ops held back by virtio_disk_plug()
+  int nplug;                   // virtio_disk_plug()s not yet unplugged
   char name[16];               // Process name (debugging)
 };
 
+// A user address space shared by the threads of a process.
+// Made when a process first calls clone(); the page table
+// is freed when the last thread using it is reaped.
+struct vmspace {
+  struct spinlock lock;
+  int ref;                // procs using pagetable; 0 if free
+  uint64 slots;           // THREADFRAME slots in use, one bit each
+  struct proc *leader;    // the process that made the first clone()
+  pagetable_t pagetable;
+  uint64 sz;              // size of the shared user memory
+};
+
 enum containerstate { FREE, CREATED, STARTED, PAUSED, STOPPED };
 //container space ~ manage name space isolation, proess isolation, memory space isolation
+//
+//locking: cfg is a seqlock over the settings read on hot paths (state,
+//root_access, the limits, affinity, weight), so the scheduler, kalloc(),
+//balloc() and bget() read them without taking a lock. the usage counters are
+//changed atomically with cusage(). name, vc_name, rootpath and rootdir
+//are under the cnames rwlock in proc.c. lock covers the rest.
 struct container {
   int root_access;
   int proc_limit;
@@ -118,16 +183,33 @@ struct container {
   int proc_count;
   int mem_usage;
   int disk_usage;
+  int buf_limit; // percent of the buffer cache it may fill
+  int buf_usage; // buffers holding blocks it read in
   int current_pid; // the current point in the proc array
   int cidx; // the index in the proc array to start and search from
   int next_pid; // these is the next point in the proc array
   uint cpu_tokens;
   uint scheduler_tokens;
+  uint64 affinity; // harts the container's procs may run on
+  uint64 cputime[NCPUCLOCK]; // cycles charged to the container's procs, ever
+  int weight; // a proc's share of hart load when balancing
+  // real-time class: while it has budget left in the current
+  // period, the container runs ahead of the token rule, earliest
+  // deadline first. rtruntime is 0 for ordinary containers.
+  uint64 rtruntime;  // budget per period, in cycles
+  uint64 rtperiod;
+  uint64 rtbudget;   // budget left in the current period, less what a hart holds
+  uint64 rtdeadline; // end of the current period
+  uint nwakeup;      // wakeups of the container's procs, and their latency
+  uint64 wakesum;
+  uint64 wakemax;
+  struct schedhist sched; // summed over the container's procs
   enum containerstate state;
   char name[CNAME];
   char vc_name[CNAME];
   char rootpath[MAXPATH];
   struct spinlock lock;
+  struct seqlock cfg;
   struct inode *rootdir;
   uint ticks;
 };
@@ -150,6 +232,40 @@ struct ptable {
 	int count;
 };
 
+//cpu accounting for one process, or a container if pid is 0, for cpustat
+struct cpustat {
+  int pid;
+  char name[16];
+  char cname[CNAME];
+  uint64 user; // cycles running in user space
+  uint64 sys;  // cycles running in the kernel
+  uint64 wait; // cycles RUNNABLE, waiting for a hart
+  uint nmigrate; // times moved between harts by the load balancer
+  uint nwakeup;  // wakeups, and their latency to running, in cycles
+  uint64 wakesum;
+  uint64 wakemax;
+};
+
+//scheduler statistics of one process, or a container if pid is 0, for schedstat
+struct schedstat {
+  int pid;
+  char name[16];
+  char cname[CNAME];
+  struct schedhist h;
+};
+
+//per-hart run queue and load balancer state, for hartstat
+struct hartstat {
+  int hart;
+  int idle;         // clock tick stopped, waiting for work
+  int pid;          // running now, or 0
+  int nrunnable;    // run queue length
+  int load;         // weight of queued and running procs
+  uint nmigratein;  // procs pulled here by the balancer
+  uint nmigrateout; // procs pulled away by the balancer
+  uint nbalance;    // balancer runs
+};
+
 struct cinfo {
   int mem_limit;
   int disk_limit;
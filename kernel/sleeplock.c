@@ -1,4 +1,10 @@
 // Sleeping locks
+//
+// acquiresleep() is adaptive: if the lock is held by a process
+// that is running on another hart, it is likely to be released
+// soon (buffer and inode locks are mostly held briefly), so spin
+// for up to SLEEPSPIN cycles before falling back to sleep(),
+// which would cost two trips through the scheduler.
 
 #include "types.h"
 #include "riscv.h"
@@ -9,24 +15,89 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+#define SLEEPSPIN (CLINT_FREQ / 20000) // 50us of spinning before sleeping
+#define NSLOCK 200
+
+static int nslock;
+static struct sleeplock *slocks[NSLOCK];
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
+  int i;
+
+  initsleeplocknostat(lk, name);
   initlock(&lk->lk, "sleep lock");
+  if(nslock < NSLOCK && (i = __sync_fetch_and_add(&nslock, 1)) < NSLOCK)
+    slocks[i] = lk;
+}
+
+// Like initsleeplock(), but left out of the statistics, for
+// sleep-locks in memory that may be freed again.
+void
+initsleeplocknostat(struct sleeplock *lk, char *name)
+{
+  initlocknostat(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->nsleeping = 0;
+  lk->nacquire = 0;
+  lk->nspin = 0;
+  lk->nsleep = 0;
+}
+
+// Wait without lk->lk for the holder to let go, as long as it
+// stays on a hart and for no more than SLEEPSPIN cycles.
+// Returns 1 if the lock looks free.
+static int
+spinwait(struct sleeplock *lk, struct proc *owner)
+{
+  uint64 end = mtime() + SLEEPSPIN;
+
+  while(*(volatile uint*)&lk->locked){
+    if(*(struct proc * volatile *)&lk->owner != owner ||
+       *(volatile enum procstate*)&owner->state != RUNNING ||
+       mtime() >= end)
+      return 0;
+  }
+  return 1;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *owner;
+  int spun, slept;
+
+  spun = slept = 0;
   acquire(&lk->lk);
   while (lk->locked) {
+    owner = lk->owner;
+    // a lock this process holds for async I/O, such as a
+    // readahead buffer, is let go by the disk interrupt,
+    // which spinning against ourselves can't hurry.
+    if(!spun && owner && owner != myproc() && owner->state == RUNNING){
+      spun = 1;
+      release(&lk->lk);
+      spinwait(lk, owner);
+      acquire(&lk->lk);
+      continue;
+    }
+    slept = 1;
+    lk->nsleeping++;
     sleep(lk, &lk->lk);
+    lk->nsleeping--;
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  lk->nacquire++;
+  if(slept)
+    lk->nsleep++;
+  else if(spun)
+    lk->nspin++;
   release(&lk->lk);
 }
 
@@ -36,7 +107,10 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  // spinners see locked go to 0; only sleepers need waking.
+  if(lk->nsleeping)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -51,5 +125,48 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Clear every sleep lock's contention statistics.
+void
+sleeplockreset(void)
+{
+  int i, n;
 
+  n = nslock < NSLOCK ? nslock : NSLOCK;
+  for(i = 0; i < n; i++){
+    acquire(&slocks[i]->lk);
+    slocks[i]->nacquire = slocks[i]->nspin = slocks[i]->nsleep = 0;
+    release(&slocks[i]->lk);
+  }
+}
 
+// Print contention statistics of sleep locks, summed over the
+// locks of each name (all buffers, all inodes, ...).
+void
+sleeplockstat(void)
+{
+  int i, j, n;
+  uint acq, spin, slp;
+  char *name;
+
+  n = nslock < NSLOCK ? nslock : NSLOCK;
+  printf("=== sleep locks:\n");
+  for(i = 0; i < n; i++){
+    name = slocks[i]->name;
+    // report each name once, at its first lock.
+    for(j = 0; j < i; j++)
+      if(strncmp(slocks[j]->name, name, 16) == 0)
+        break;
+    if(j < i)
+      continue;
+    acq = spin = slp = 0;
+    for(j = i; j < n; j++){
+      if(strncmp(slocks[j]->name, name, 16) != 0)
+        continue;
+      acq += slocks[j]->nacquire;
+      spin += slocks[j]->nspin;
+      slp += slocks[j]->nsleep;
+    }
+    if(acq)
+      printf("sleeplock: %s: #acquire %d #spun %d #slept %d\n", name, acq, spin, slp);
+  }
+}
@@ -2,9 +2,15 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding lock, for adaptive spinning
+  int nsleeping;     // Processes asleep waiting for it
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
-};
 
+  // Contention statistics, under lk:
+  uint nacquire;     // acquisitions
+  uint nspin;        // ... that found it held and got it by spinning
+  uint nsleep;       // ... that found it held and slept
+};
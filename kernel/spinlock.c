@@ -9,42 +9,94 @@
 #include "defs.h"
 
 #define NLOCK 1000
+#define SPINBACKOFF 16 // nops to wait per ticket ahead before looking again
+#define NTOPLOCK 10    // locks in the sys_ntas() report
 
 static int nlock;
 static struct spinlock *locks[NLOCK];
 
-// assumes locks are not freed
+// Lock statistics. Each hart counts into its own row, with
+// interrupts off inside acquire()/release(), so the counting
+// needs no atomics and adds no traffic to the locks' cache
+// lines. Collection is compiled in with LOCKSTAT and switched
+// on and off at run time through sys_ntas(); while it is off,
+// acquire() and release() only test lockstat_on.
+struct lockstat {
+  uint nacquire;   // acquisitions
+  uint ncontend;   // acquisitions that had to wait
+  uint64 wait;     // cycles spent waiting
+  uint64 hold;     // cycles held
+  uint64 maxhold;  // longest hold
+  uint64 maxpc;    // ... and where it was acquired from
+};
+
+#if LOCKSTAT
+static struct lockstat lockstats[NCPU][NLOCK];
+static int lockstat_on;
+#endif
+
+// assumes locks are not freed.
+// procs are created on demand, so there can be more locks
+// than NLOCK; those still work but are left out of lockstat.
 void
 initlock(struct spinlock *lk, char *name)
+{
+  int i;
+
+  initlocknostat(lk, name);
+  if(nlock >= NLOCK || (i = __sync_fetch_and_add(&nlock, 1)) >= NLOCK)
+    return;
+  locks[i] = lk;
+  lk->id = i + 1;
+}
+
+// Like initlock(), but left out of lockstat, for locks in
+// memory that may be freed again.
+void
+initlocknostat(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
-  lk->nts = 0;
-  lk->n = 0;
-  if(nlock >= NLOCK)
-    panic("initlock");
-  locks[nlock] = lk;
-  nlock++;
+  lk->id = 0;
+  lk->tacquire = 0;
+  lk->pc = 0;
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
+//
+// Takes a ticket with one atomic add, then waits with plain
+// loads until owner reaches it, so waiters share the cache line
+// read-only instead of each hammering it with an amoswap, and
+// get the lock in the order they asked. The wait backs off in
+// proportion to the number of tickets ahead. Interrupts stay
+// off from before the ticket is taken until release(): a hart
+// holding a ticket must not be interrupted into code that wants
+// the same lock, since its ticket would block it forever.
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, ahead, spins, i;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  __sync_fetch_and_add(&(lk->n), 1);
-    
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-     __sync_fetch_and_add(&lk->nts, 1);
+#if LOCKSTAT
+  uint64 start = 0;
+  if(lockstat_on && lk->id)
+    start = mtime();
+#endif
+
+  // On RISC-V, this is an amoadd.w.
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  spins = 0;
+  while((ahead = ticket - *(volatile uint*)&lk->owner) != 0){
+    for(i = 0; i < ahead * SPINBACKOFF; i++)
+      asm volatile("nop");
+    spins++;
   }
   
   // Tell the C compiler and the processor to not move loads or stores
@@ -55,6 +107,53 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->pc = (uint64)__builtin_return_address(0);
+  lk->tacquire = 0;
+#if LOCKSTAT
+  if(start){
+    struct lockstat *ls = &lockstats[cpuid()][lk->id - 1];
+    lk->tacquire = mtime();
+    ls->nacquire++;
+    if(spins){
+      ls->ncontend++;
+      ls->wait += lk->tacquire - start;
+    }
+  }
+#endif
+}
+
+// Acquire the lock if it is free, without waiting.
+// Returns 1 if it was acquired, 0 if not. For code that
+// must not wait for the lock because of what it holds.
+int
+tryacquire(struct spinlock *lk)
+{
+  uint ticket;
+
+  push_off();
+  if(holding(lk))
+    panic("tryacquire");
+
+  // the lock is free while owner == next; take that ticket
+  // only if no one else has taken it in the meantime.
+  ticket = *(volatile uint*)&lk->owner;
+  if(*(volatile uint*)&lk->next != ticket ||
+     !__sync_bool_compare_and_swap(&lk->next, ticket, ticket + 1)){
+    pop_off();
+    return 0;
+  }
+  __sync_synchronize();
+
+  lk->cpu = mycpu();
+  lk->pc = (uint64)__builtin_return_address(0);
+  lk->tacquire = 0;
+#if LOCKSTAT
+  if(lockstat_on && lk->id){
+    lk->tacquire = mtime();
+    lockstats[cpuid()][lk->id - 1].nacquire++;
+  }
+#endif
+  return 1;
 }
 
 // Release the lock.
@@ -64,6 +163,19 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#if LOCKSTAT
+  if(lk->tacquire){
+    struct lockstat *ls = &lockstats[cpuid()][lk->id - 1];
+    uint64 hold = mtime() - lk->tacquire;
+    ls->hold += hold;
+    if(hold > ls->maxhold){
+      ls->maxhold = hold;
+      ls->maxpc = lk->pc;
+    }
+    lk->tacquire = 0;
+  }
+#endif
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -74,14 +186,10 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Release the lock by letting the next ticket in. Only the
+  // holder writes owner, so a single store does it; it is a
+  // volatile store so that the compiler emits exactly one sw.
+  *(volatile uint*)&lk->owner = lk->owner + 1;
 
   pop_off();
 }
@@ -92,10 +200,116 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
   return r;
 }
 
+#define RWWRITER 0x80000000 // rwlock write-held
+#define RWWAIT   0x40000000 // a writer is waiting
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  rw->v = 0;
+  rw->name = name;
+}
+
+// Acquire rw shared, once no writer holds it or waits for it.
+void
+read_acquire(struct rwlock *rw)
+{
+  uint v;
+
+  push_off();
+  for(;;){
+    v = *(volatile uint*)&rw->v;
+    if((v & (RWWRITER|RWWAIT)) == 0 && __sync_bool_compare_and_swap(&rw->v, v, v + 1))
+      break;
+  }
+  __sync_synchronize();
+}
+
+void
+read_release(struct rwlock *rw)
+{
+  __sync_synchronize();
+  __sync_fetch_and_sub(&rw->v, 1);
+  pop_off();
+}
+
+// Acquire rw exclusive. Sets RWWAIT while the readers drain,
+// so that no new ones get in.
+void
+write_acquire(struct rwlock *rw)
+{
+  uint v;
+
+  push_off();
+  for(;;){
+    v = *(volatile uint*)&rw->v;
+    if((v & ~RWWAIT) == 0 && __sync_bool_compare_and_swap(&rw->v, v, RWWRITER))
+      break;
+    if((v & RWWAIT) == 0)
+      __sync_fetch_and_or(&rw->v, RWWAIT);
+  }
+  __sync_synchronize();
+}
+
+void
+write_release(struct rwlock *rw)
+{
+  __sync_synchronize();
+  // keep RWWAIT if another writer has set it meanwhile.
+  __sync_fetch_and_and(&rw->v, ~RWWRITER);
+  pop_off();
+}
+
+void
+initseqlock(struct seqlock *sl, char *name)
+{
+  sl->seq = 0;
+  initlock(&sl->lk, name);
+}
+
+void
+write_seqlock(struct seqlock *sl)
+{
+  acquire(&sl->lk);
+  sl->seq++;
+  __sync_synchronize();
+}
+
+void
+write_sequnlock(struct seqlock *sl)
+{
+  __sync_synchronize();
+  sl->seq++;
+  release(&sl->lk);
+}
+
+// Start a lock-free read of the data sl protects: wait out any
+// writer, and return the sequence number to check against with
+// read_seqretry() once done reading.
+uint
+read_seqbegin(struct seqlock *sl)
+{
+  uint s;
+
+  while((s = *(volatile uint*)&sl->seq) & 1)
+    ;
+  __sync_synchronize();
+  return s;
+}
+
+// Did a writer get in since read_seqbegin() returned s? Then
+// what was read may be torn, and the read must be redone.
+int
+read_seqretry(struct seqlock *sl, uint s)
+{
+  __sync_synchronize();
+  return *(volatile uint*)&sl->seq != s;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -124,55 +338,150 @@ pop_off(void)
     intr_on();
 }
 
-void
-print_lock(struct spinlock *lk)
+#if LOCKSTAT
+// lockstats summed over all harts, for the report.
+static struct lockstat lstotal[NLOCK];
+
+static void
+print_lock(int i)
 {
-  if(lk->n > 0) 
-    printf("lock: %s: #test-and-set %d #acquire() %d\n", lk->name, lk->nts, lk->n);
+  struct lockstat *t = &lstotal[i];
+
+  printf("lock: %s: #acquire() %d #contended %d wait %dus hold %dus maxhold %dus at %p\n",
+         locks[i]->name, t->nacquire, t->ncontend,
+         (int)(t->wait / (CLINT_FREQ / 1000000)), (int)(t->hold / (CLINT_FREQ / 1000000)),
+         (int)(t->maxhold / (CLINT_FREQ / 1000000)), t->maxpc);
 }
 
+// the sort key of lock i's statistics: wait time, or hold time.
+static uint64
+lockkey(int i, int byhold)
+{
+  return byhold ? lstotal[i].hold : lstotal[i].wait;
+}
+#endif
+
+// Lock statistics control and report.
+//   ntas(0)  clear the statistics and start collecting
+//   ntas(-1) stop collecting
+//   ntas(1)  print kmem's locks and the top locks by wait time,
+//            then sleep lock contention
+//   ntas(2)  the same, by hold time
+// Returns the number of contended kmem acquisitions for 1 and 2,
+// which kalloctest and bcachetest look at.
 uint64
 sys_ntas(void)
 {
-  int zero = 0;
+  int cmd;
   int tot = 0;
   
-  if (argint(0, &zero) < 0) {
+  if (argint(0, &cmd) < 0) {
     return -1;
   }
-  if(zero == 0) {
-    for(int i = 0; i < NLOCK; i++) {
-      if(locks[i] == 0)
-        break;
-      locks[i]->nts = 0;
-    }
+  // starting and stopping collection is system-wide.
+  if (cmd <= 0 && !myproc()->container->root_access)
+    return -1;
+#if LOCKSTAT
+  int i, j, n, t, top[NTOPLOCK];
+
+  if(cmd == 0) {
+    lockstat_on = 0;
+    memset(lockstats, 0, sizeof(lockstats));
+    sleeplockreset();
+    __sync_synchronize();
+    lockstat_on = 1;
+    return 0;
+  }
+  if(cmd < 0) {
+    lockstat_on = 0;
     return 0;
   }
 
+  // sum the harts' rows. racy against harts still counting,
+  // which is fine for statistics.
+  n = nlock < NLOCK ? nlock : NLOCK;
+  memset(lstotal, 0, sizeof(lstotal));
+  for(j = 0; j < NCPU; j++){
+    for(i = 0; i < n; i++){
+      struct lockstat *ls = &lockstats[j][i];
+      lstotal[i].nacquire += ls->nacquire;
+      lstotal[i].ncontend += ls->ncontend;
+      lstotal[i].wait += ls->wait;
+      lstotal[i].hold += ls->hold;
+      if(ls->maxhold > lstotal[i].maxhold){
+        lstotal[i].maxhold = ls->maxhold;
+        lstotal[i].maxpc = ls->maxpc;
+      }
+    }
+  }
+
   printf("=== lock kmem stats\n");
-  for(int i = 0; i < NLOCK; i++) {
-    if(locks[i] == 0)
-      break;
+  for(i = 0; i < n; i++) {
     if(strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0) {
-      tot += locks[i]->nts;
-      print_lock(locks[i]);
+      tot += lstotal[i].ncontend;
+      print_lock(i);
     }
   }
 
-  printf("=== top 5 contended locks:\n");
-  int last = 100000000;
-  // stupid way to compute top 5 contended locks
-  for(int t= 0; t < 5; t++) {
-    int top = 0;
-    for(int i = 0; i < NLOCK; i++) {
-      if(locks[i] == 0)
-        break;
-      if(locks[i]->nts > locks[top]->nts && locks[i]->nts < last) {
-        top = i;
-      }
-    }
-    print_lock(locks[top]);
-    last = locks[top]->nts;
+  printf("=== top %d locks by %s time:\n", NTOPLOCK, cmd == 2 ? "hold" : "wait");
+  // insertion sort of the top NTOPLOCK.
+  t = 0;
+  for(i = 0; i < n; i++) {
+    if(lstotal[i].nacquire == 0)
+      continue;
+    for(j = t; j > 0 && lockkey(top[j-1], cmd == 2) < lockkey(i, cmd == 2); j--)
+      if(j < NTOPLOCK)
+        top[j] = top[j-1];
+    if(j < NTOPLOCK)
+      top[j] = i;
+    if(t < NTOPLOCK)
+      t++;
   }
+  for(i = 0; i < t; i++)
+    print_lock(top[i]);
+  sleeplockstat();
+#else
+  if(cmd > 0)
+    printf("lock statistics not compiled in (LOCKSTAT)\n");
+#endif
   return tot;
 }
+
+// Lock benchmark for user/lockbench.c: for the given number of
+// mtime cycles, repeatedly take a shared lock, do a little work
+// under it, and drop it. tas selects the old test-and-set
+// spinlock instead of acquire()'s ticket lock, for comparison.
+// Stops early if the process is killed.
+// Returns the number of acquisitions.
+static struct spinlock benchlock = { .name = "lockbench" };
+static uint benchtas;
+static volatile uint64 benchdata[8];
+
+int
+lockbench(int tas, uint64 cycles)
+{
+  uint64 end;
+  int i, n;
+
+  end = mtime() + cycles;
+  for(n = 0; mtime() < end && !myproc()->killed; n++){
+    if(tas){
+      push_off();
+      while(__sync_lock_test_and_set(&benchtas, 1) != 0)
+        ;
+      __sync_synchronize();
+    } else {
+      acquire(&benchlock);
+    }
+    for(i = 0; i < NELEM(benchdata); i++)
+      benchdata[i]++;
+    if(tas){
+      __sync_synchronize();
+      __sync_lock_release(&benchtas);
+      pop_off();
+    } else {
+      release(&benchlock);
+    }
+  }
+  return n;
+}
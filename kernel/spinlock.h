@@ -1,11 +1,33 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock. A ticket lock: acquirers take the
+// next ticket and wait for owner to reach it, so the lock is
+// handed out in FIFO order, and is held while owner != next.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket now allowed to hold the lock.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
-  uint n;
-  uint nts;
+
+  // For lock statistics; only the holder writes these.
+  int id;            // 1 + index in the lockstat tables, or 0.
+  uint64 tacquire;   // mtime when acquired, if lockstat was on.
+  uint64 pc;         // Where it was acquired from.
 };
 
+// Reader-writer spin lock, for data read on many harts at once
+// and rarely written: any number of readers, or one writer. A
+// waiting writer holds off new readers, so it can't starve.
+struct rwlock {
+  uint v;            // RWWRITER, or the number of readers, plus RWWAIT.
+  char *name;        // Name of lock.
+};
+
+// Sequence lock, for small data read far more often than it is
+// written. Readers take no lock and write nothing: they note
+// seq, read, and retry if seq changed or was odd, meaning a
+// writer was in between. Writers serialize on lk.
+struct seqlock {
+  uint seq;          // Odd while a writer is in.
+  struct spinlock lk;
+};
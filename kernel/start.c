@@ -7,6 +7,11 @@
 void main();
 void timerinit();
 
+// clock ticks per second. HZ unless the kernel command
+// line says hz=N (make HZ=N qemu).
+int hz;
+static volatile int hzset = 0;
+
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
@@ -16,9 +21,10 @@ uint64 mscratch0[NCPU * 32];
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on stack0,
+// with the device tree address qemu passed in fdt.
 void
-start()
+start(uint64 hartid, uint64 fdt)
 {
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
@@ -38,6 +44,21 @@ start()
   w_mideleg(0xffff);
   w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
+  // read the boot-time configuration. hart 0 does it
+  // for everyone, before kinit() can reuse the device
+  // tree's memory.
+  if(r_mhartid() == 0){
+    hz = bootparam(fdt, "hz", HZ);
+    if(hz < 1 || hz > CLINT_FREQ / 1000)
+      hz = HZ;
+    __sync_synchronize();
+    hzset = 1;
+  } else {
+    while(hzset == 0)
+      ;
+    __sync_synchronize();
+  }
+
   // ask for clock interrupts.
   timerinit();
 
@@ -60,16 +81,23 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  uint64 interval = CLINT_FREQ / hz; // cycles between clock ticks.
+  uint64 next = *(uint64*)CLINT_MTIME + interval;
+  *(uint64*)CLINT_MTIMECMP(id) = next;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
-  // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : desired interval (in cycles) between clock ticks.
+  // scratch[6] : deadline of the next clock tick.
+  // scratch[7] : one-shot deadline armed by timer.c, or -1 if none.
+  // scratch[8] : address of CLINT MSIP register, for kicks from other harts.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
   scratch[5] = interval;
+  scratch[6] = next;
+  scratch[7] = -1;
+  scratch[8] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -78,6 +106,6 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -9,3 +9,26 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+#define NLAT 16    // buckets in diskstat.lat
+
+// queue statistics of one disk, for diskstat()
+struct diskstat {
+  int disk;
+  int nqueue;      // request queues
+  int poll;        // waiters poll for completion?
+  uint depth;      // requests in flight now
+  uint maxdepth;   // most ever in flight on each queue, summed
+  uint64 depthsum; // in flight just after each submit, summed
+  uint nsubmit;    // requests submitted
+  uint nqfull;     // times requests had to wait for room in the queue
+  uint nmerge;     // blocks that went in another block's request
+  uint nread;      // requests completed
+  uint nwrite;
+  uint nnotify;    // times the disk was told of new requests
+  uint nintr;      // completion interrupts
+  uint devlat;     // recent device latency, microseconds
+  uint npoll;      // waits that polling finished
+  uint npollmiss;  // waits that polled, then slept
+  uint lat[NLAT];  // waits taking [2^i, 2^(i+1)) microseconds; lat[0] from 0
+};
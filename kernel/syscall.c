@@ -119,6 +119,23 @@ extern uint64 sys_cstop(void);
 extern uint64 sys_root_access(void);
 extern uint64 sys_ticks(void);
 extern uint64 sys_freememory(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_getaffinity(void);
+extern uint64 sys_csetaffinity(void);
+extern uint64 sys_cpustat(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_hartstat(void);
+extern uint64 sys_csetweight(void);
+extern uint64 sys_csetrt(void);
+extern uint64 sys_schedstat(void);
+extern uint64 sys_lockbench(void);
+extern uint64 sys_diskstat(void);
+extern uint64 sys_diskbench(void);
+extern uint64 sys_diskpoll(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -156,7 +173,24 @@ static uint64 (*syscalls[])(void) = {
 [SYS_cstop] sys_cstop,
 [SYS_root_access] sys_root_access,
 [SYS_ticks] sys_ticks,
-[SYS_freememory] sys_freememory
+[SYS_freememory] sys_freememory,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getaffinity] sys_getaffinity,
+[SYS_csetaffinity] sys_csetaffinity,
+[SYS_cpustat] sys_cpustat,
+[SYS_clone] sys_clone,
+[SYS_join] sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_hartstat] sys_hartstat,
+[SYS_csetweight] sys_csetweight,
+[SYS_csetrt] sys_csetrt,
+[SYS_schedstat] sys_schedstat,
+[SYS_lockbench] sys_lockbench,
+[SYS_diskstat] sys_diskstat,
+[SYS_diskbench] sys_diskbench,
+[SYS_diskpoll] sys_diskpoll
 };
 
 void
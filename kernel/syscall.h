@@ -38,4 +38,21 @@
 #define SYS_cstop 33
 #define SYS_root_access 34
 #define SYS_ticks 35
-#define SYS_freememory 36
\ No newline at end of file
+#define SYS_freememory 36
+#define SYS_nanosleep 37
+#define SYS_setaffinity 38
+#define SYS_getaffinity 39
+#define SYS_csetaffinity 40
+#define SYS_cpustat 41
+#define SYS_clone 42
+#define SYS_join 43
+#define SYS_futex_wait 44
+#define SYS_futex_wake 45
+#define SYS_hartstat 46
+#define SYS_csetweight 47
+#define SYS_csetrt 48
+#define SYS_schedstat 49
+#define SYS_lockbench 50
+#define SYS_diskstat 51
+#define SYS_diskbench 52
+#define SYS_diskpoll 53
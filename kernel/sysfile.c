@@ -128,6 +128,40 @@ sys_close(void)
   return 0;
 }
 
+// copy out the queue statistics of up to n disks
+uint64
+sys_diskstat(void)
+{
+  uint64 st;
+  int n;
+  struct proc *p;
+
+  if(argaddr(0, &st) < 0 || argint(1, &n) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_diskstat(%p, %d)\n", p -> pid, st, n);
+  return diskstat(st, n);
+}
+
+// turn completion polling on a disk on or off
+uint64
+sys_diskpoll(void)
+{
+  int n, on;
+  struct proc *p;
+
+  if(argint(0, &n) < 0 || argint(1, &on) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_diskpoll(%d, %d)\n", p -> pid, n, on);
+  // polling is disk-wide, for every container.
+  if (!p->container->root_access)
+    return -1;
+  return diskpoll(n, on);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -160,7 +194,7 @@ sys_link(void)
   if (p -> tracing)
   	printf(" [%d] sys_link(\"%s\", \"%s\")\n", p -> pid, old, new);
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_LINK);
   if((ip = namei(old)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -232,7 +266,7 @@ sys_unlink(void)
   if (p -> tracing)
   	printf(" [%d] sys_unlink(\"%s\")\n", p -> pid, path);
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_UNLINK);
   if((dp = nameiparent(path, name)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -339,7 +373,7 @@ sys_open(void)
   if (p -> tracing)
   	printf(" [%d] sys_open(\"%s\", %d)\n", p -> pid, path, omode);
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, (omode & O_CREATE) ? LOGOP_CREATE : LOGOP_IPUT);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -399,7 +433,7 @@ sys_mkdir(void)
   struct inode *ip;
   struct proc *p;
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_CREATE);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -422,7 +456,7 @@ sys_mknod(void)
   struct inode *ip;
   struct proc *p;
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_CREATE);
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -447,7 +481,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p;
 
-  begin_op(ROOTDEV);
+  begin_op(ROOTDEV, LOGOP_IPUT);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op(ROOTDEV);
     return -1;
@@ -67,7 +67,8 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr, n;
+  uint64 addr;
+  int n;
   struct proc *p;
 
   if(argint(0, &n) < 0)
@@ -76,9 +77,8 @@ sys_sbrk(void)
   p = myproc();
   if (p -> tracing)
   	printf(" [%d] sys_sbrk(%d)\n", p -> pid, n);
-  addr = p -> sz;
   //addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -87,7 +87,6 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
   struct proc *p;
 
   if(argint(0, &n) < 0)
@@ -97,17 +96,35 @@ sys_sleep(void)
   if (p -> tracing)
   	printf(" [%d] sys_sleep(%d)\n", p ->  pid, n);
 
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return 0;
+  return timersleep(mtime() + (uint64)n * (CLINT_FREQ / hz));
+}
+
+// longest nanosleep(), a year, so that the cycle count
+// can't overflow.
+#define MAXNSEC ((uint64)365 * 24 * 60 * 60 * 1000000000)
+
+// sleep for at least nsec nanoseconds. the CLINT
+// counts at CLINT_FREQ, so this is rounded up to the
+// next 100ns in qemu.
+uint64
+sys_nanosleep(void)
+{
+  uint64 nsec, cycles;
+  struct proc *p;
+
+  if(argaddr(0, &nsec) < 0)
+    return -1;
+
+  p = myproc();
+  if (p -> tracing)
+  	printf(" [%d] sys_nanosleep(%p)\n", p ->  pid, nsec);
+
+  if(nsec > MAXNSEC)
+    nsec = MAXNSEC;
+  cycles = (nsec * (CLINT_FREQ / 1000000) + 999) / 1000;
+  return timersleep(mtime() + cycles);
 }
 
 uint64
@@ -137,11 +154,12 @@ sys_uptime(void)
   if (p -> tracing)
   	printf(" [%d] sys_uptime(void)\n", p -> pid);
   
-  uint xticks;
+  uint xticks, s;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
+  do {
+    s = read_seqbegin(&tickslock);
+    xticks = ticks;
+  } while(read_seqretry(&tickslock, s));
   return xticks;
 }
 
@@ -227,14 +245,15 @@ sys_cresume(void)
 uint64 
 sys_cstart(void)
 {
-  int vcn = 0, vcname = 1, container = 2, rootdir = 3, program = 4, vcfd;
+  int vcn = 0, vcname = 1, container = 2, rootdir = 3, program = 4, cpus = 5, vcfd, mask;
   char vname[CNAME] = { 0 }, cname[CNAME] = { 0 }, rootpath[MAXPATH] = { 0 }, command[MAXPATH] = { 0 };
   if (argint(vcn, &vcfd) < 0) return -1;
   if (argstr(vcname, vname, CNAME) < 0) return -1;
   if (argstr(container, cname, CNAME) < 0) return -1;
   if (argstr(rootdir, rootpath, CNAME) < 0) return -1;
   if (argstr(program, command, CNAME) < 0) return -1;
-  return cstart(vcfd, vname, cname, rootpath, command);
+  if (argint(cpus, &mask) < 0) return -1;
+  return cstart(vcfd, vname, cname, rootpath, command, (uint)mask);
 }
 
 uint64 
@@ -255,10 +274,11 @@ sys_root_access(void)
 uint64
 sys_ticks(void)
 {
-  uint time;
-  acquire(&tickslock);
-  time = ticks;
-  release(&tickslock);
+  uint time, s;
+  do {
+    s = read_seqbegin(&tickslock);
+    time = ticks;
+  } while(read_seqretry(&tickslock, s));
   return time;
 }
 
@@ -267,4 +287,222 @@ sys_freememory(void)
 {
   freememory();
   return 1;
-}
\ No newline at end of file
+}
+
+//pin a process (0 for the caller) to the harts in a mask
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+  struct proc *p;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_setaffinity(%d, %x)\n", p -> pid, pid, mask);
+  return setaffinity(pid, (uint)mask);
+}
+
+//the mask of harts a process (0 for the caller) runs on
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+  struct proc *p;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_getaffinity(%d)\n", p -> pid, pid);
+  return getaffinity(pid);
+}
+
+//pin every process of a container to the harts in a mask
+uint64
+sys_csetaffinity(void)
+{
+  int mask;
+  char cname[CNAME] = { 0 };
+
+  if (argstr(0, cname, CNAME) < 0 || argint(1, &mask) < 0) return -1;
+  return csetaffinity(cname, (uint)mask);
+}
+
+//copy cpu accounting for processes and containers into the user
+uint64
+sys_cpustat(void)
+{
+  uint64 st;
+  int n;
+  struct proc *p;
+
+  if(argaddr(0, &st) < 0 || argint(1, &n) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_cpustat(%p, %d)\n", p -> pid, st, n);
+  return cpustat(st, n);
+}
+
+//start a thread at fn(arg) on the given stack, sharing our memory
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+  struct proc *p;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_clone(%p, %p, %p)\n", p -> pid, fn, arg, stack);
+  return clone(fn, arg, stack);
+}
+
+//wait for one of our threads to exit
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 status;
+  struct proc *p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &status) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_join(%d, %p)\n", p -> pid, tid, status);
+  return join(tid, status);
+}
+
+//sleep while *addr == val, until futex_wake or nsec runs out (0 is forever)
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr, nsec;
+  int val;
+  struct proc *p;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0 || argaddr(2, &nsec) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_futex_wait(%p, %d, %p)\n", p -> pid, addr, val, nsec);
+  return futexwait(addr, val, nsec);
+}
+
+//wake up to n sleepers in futex_wait on addr
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+  struct proc *p;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_futex_wake(%p, %d)\n", p -> pid, addr, n);
+  return futexwake(addr, n);
+}
+
+//copy per-hart run queue and load balancer state into the user
+uint64
+sys_hartstat(void)
+{
+  uint64 st;
+  int n;
+  struct proc *p;
+
+  if(argaddr(0, &st) < 0 || argint(1, &n) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_hartstat(%p, %d)\n", p -> pid, st, n);
+  return hartstat(st, n);
+}
+
+//set the load balancing weight of a container's processes
+uint64
+sys_csetweight(void)
+{
+  int weight;
+  char cname[CNAME] = { 0 };
+
+  if (argstr(0, cname, CNAME) < 0 || argint(1, &weight) < 0) return -1;
+  return csetweight(cname, weight);
+}
+
+//give a container a real-time budget of runtime us every period us
+uint64
+sys_csetrt(void)
+{
+  int runtime, period;
+  char cname[CNAME] = { 0 };
+
+  if (argstr(0, cname, CNAME) < 0 || argint(1, &runtime) < 0 || argint(2, &period) < 0) return -1;
+  return csetrt(cname, runtime, period);
+}
+
+//copy scheduler statistics into the user, and optionally reset them
+uint64
+sys_schedstat(void)
+{
+  uint64 st;
+  int n, reset;
+  struct proc *p;
+
+  if(argaddr(0, &st) < 0 || argint(1, &n) < 0 || argint(2, &reset) < 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_schedstat(%p, %d, %d)\n", p -> pid, st, n, reset);
+  return schedstat(st, n, reset);
+}
+
+// longest a benchmark may run, in milliseconds
+#define BENCHMAXMS 10000
+
+//hammer a kernel spinlock for some milliseconds, for user/lockbench
+uint64
+sys_lockbench(void)
+{
+  int tas, ms;
+  struct proc *p;
+
+  if(argint(0, &tas) < 0 || argint(1, &ms) < 0 || ms <= 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_lockbench(%d, %d)\n", p -> pid, tas, ms);
+  // the lock is shared by every container, and the tas
+  // loop spins with interrupts off.
+  if (!p->container->root_access)
+    return -1;
+  if (ms > BENCHMAXMS)
+    ms = BENCHMAXMS;
+  return lockbench(tas, (uint64)ms * (CLINT_FREQ / 1000));
+}
+
+//read random disk blocks for some milliseconds, for user/diskbench
+uint64
+sys_diskbench(void)
+{
+  int ms;
+  struct proc *p;
+
+  if(argint(0, &ms) < 0 || ms <= 0)
+    return -1;
+  p = myproc();
+  if (p -> tracing)
+    printf(" [%d] sys_diskbench(%d)\n", p -> pid, ms);
+  // the disk's queues are shared by every container.
+  if (!p->container->root_access)
+    return -1;
+  if (ms > BENCHMAXMS)
+    ms = BENCHMAXMS;
+  return diskbench((uint64)ms * (CLINT_FREQ / 1000));
+}
@@ -0,0 +1,340 @@
+// High-resolution timers.
+//
+// Each hart keeps its own hierarchical timer wheel, keyed on the
+// CLINT's mtime. Level 0 has LVLSIZE slots that are 2^GRANBITS
+// cycles wide, and each level up is LVLSIZE times coarser. A timer
+// goes in the finest level that can hold its deadline and is only
+// looked at again when its slot comes around, at which point it is
+// either fired or cascaded down a level.
+//
+// The hart arms a one-shot mtimecmp deadline (scratch[7], see
+// start.c and timervec) for the earliest timer on its wheel, so
+// timers fire at their deadline instead of at the next clock tick,
+// and only the owner of an expired timer gets woken up. An idle
+// hart stops its clock tick altogether (tickstop()) and is only
+// interrupted by its own timers and by devices.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "timer.h"
+
+#define LVLBITS   6
+#define LVLSIZE   (1 << LVLBITS)
+#define LVLMASK   (LVLSIZE - 1)
+#define NLEVEL    4
+#define GRANBITS  10   // level 0 slots are 1024 cycles, ~100us in qemu.
+#define LVLSHIFT(l) ((l) * LVLBITS)
+#define MAXDELTA  ((1L << (NLEVEL * LVLBITS)) - 1) // in level 0 slots
+
+struct timerwheel {
+  struct spinlock lock;
+  uint64 clk;     // next level 0 slot to look at, in 2^GRANBITS cycles
+  uint64 next;    // earliest deadline on the wheel, or -1
+  int count;      // number of pending timers
+  struct list slot[NLEVEL][LVLSIZE];
+};
+
+struct timerwheel wheels[NCPU];
+
+extern uint64 mscratch0[]; // start.c
+
+// cycles since boot.
+uint64
+mtime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
+
+void
+timerwheelinit(void)
+{
+  struct timerwheel *w;
+  int l, i;
+
+  for(w = wheels; w < &wheels[NCPU]; w++){
+    initlock(&w->lock, "timerwheel");
+    w->clk = 0;
+    w->next = -1;
+    w->count = 0;
+    for(l = 0; l < NLEVEL; l++)
+      for(i = 0; i < LVLSIZE; i++)
+        lst_init(&w->slot[l][i]);
+  }
+}
+
+// Ask timervec for a timer interrupt on hart id at when,
+// in addition to the clock tick. when == -1 disarms.
+// Must run on hart id with interrupts off.
+static void
+timerarm(int id, uint64 when)
+{
+  uint64 *scratch = &mscratch0[32 * id];
+  volatile uint64 *cmp = (uint64*)CLINT_MTIMECMP(id);
+
+  scratch[7] = when;
+  // if timervec runs in between, it folds scratch[7] into
+  // mtimecmp itself; at worst we get a spurious interrupt.
+  if(when < *cmp)
+    *cmp = when;
+}
+
+// Put t in the slot for its deadline.
+// Caller holds w->lock.
+static void
+enqueue(struct timerwheel *w, struct timer *t)
+{
+  uint64 e, delta;
+  int l;
+
+  e = t->expires >> GRANBITS;
+  if(e < w->clk)
+    e = w->clk;   // already due; look at it on the next run.
+  delta = e - w->clk;
+  if(delta > MAXDELTA){
+    // too far out; park it at the edge and re-cascade later.
+    e = w->clk + MAXDELTA;
+    delta = MAXDELTA;
+  }
+  for(l = 0; l < NLEVEL - 1; l++)
+    if(delta < (1L << LVLSHIFT(l + 1)))
+      break;
+  lst_push(&w->slot[l][(e >> LVLSHIFT(l)) & LVLMASK], t);
+}
+
+// Move the timers in level l's current slot down to finer levels.
+static void
+cascade(struct timerwheel *w, int l)
+{
+  struct list *s = &w->slot[l][(w->clk >> LVLSHIFT(l)) & LVLMASK];
+  struct list tmp;
+
+  if(lst_empty(s))
+    return;
+  lst_init(&tmp);
+  while(!lst_empty(s))
+    lst_push(&tmp, lst_pop(s));
+  while(!lst_empty(&tmp))
+    enqueue(w, (struct timer*)lst_pop(&tmp));
+}
+
+static uint64 earliest(struct timerwheel *w);
+
+// Put every timer on w back in the slot for its deadline, after
+// w->clk has jumped.
+static void
+rehash(struct timerwheel *w)
+{
+  struct list tmp;
+  int l, i;
+
+  lst_init(&tmp);
+  for(l = 0; l < NLEVEL; l++)
+    for(i = 0; i < LVLSIZE; i++)
+      while(!lst_empty(&w->slot[l][i]))
+        lst_push(&tmp, lst_pop(&w->slot[l][i]));
+  while(!lst_empty(&tmp))
+    enqueue(w, (struct timer*)lst_pop(&tmp));
+}
+
+// Fire every timer on w whose deadline is at or before now.
+// Caller holds w->lock.
+static void
+runwheel(struct timerwheel *w, uint64 now)
+{
+  uint64 target = now >> GRANBITS;
+  uint64 first;
+  struct list *s, *e, *next;
+  struct timer *t;
+  int l;
+
+  if(w->count == 0){
+    w->clk = target;
+    return;
+  }
+
+  for(;;){
+    for(l = NLEVEL - 1; l > 0; l--)
+      if((w->clk & ((1L << LVLSHIFT(l)) - 1)) == 0)
+        cascade(w, l);
+
+    s = &w->slot[0][w->clk & LVLMASK];
+    for(e = s->next; e != s; e = next){
+      next = e->next;
+      t = (struct timer*)e;
+      if(t->expires > now)
+        continue;  // later in this same slot.
+      lst_remove(e);
+      t->pending = 0;
+      w->count--;
+      t->fn(t);
+    }
+
+    if(w->clk >= target || w->count == 0)
+      break;
+    // after a long tickless idle there may be millions of
+    // empty slots to go; jump over them to the next deadline.
+    first = earliest(w) >> GRANBITS;
+    if(first > w->clk + 1){
+      w->clk = first < target ? first : target;
+      rehash(w);
+    } else {
+      w->clk++;
+    }
+  }
+  if(w->count == 0)
+    w->clk = target;
+}
+
+// Earliest deadline on w, or -1 if it is empty.
+// Caller holds w->lock.
+static uint64
+earliest(struct timerwheel *w)
+{
+  struct list *s, *e;
+  uint64 min = -1;
+  int l, i;
+
+  if(w->count == 0)
+    return min;
+  for(l = 0; l < NLEVEL; l++){
+    for(i = 0; i < LVLSIZE; i++){
+      s = &w->slot[l][i];
+      for(e = s->next; e != s; e = e->next)
+        if(((struct timer*)e)->expires < min)
+          min = ((struct timer*)e)->expires;
+    }
+  }
+  return min;
+}
+
+// Add t to this hart's wheel. t->expires, t->fn and t->arg
+// must be set. t->fn(t) will be called from the timer interrupt
+// on this hart once mtime reaches t->expires.
+void
+timeradd(struct timer *t)
+{
+  struct timerwheel *w;
+
+  push_off();
+  w = &wheels[cpuid()];
+  acquire(&w->lock);
+  if(w->count == 0)
+    w->clk = mtime() >> GRANBITS;
+  t->w = w;
+  t->pending = 1;
+  w->count++;
+  enqueue(w, t);
+  if(t->expires < w->next){
+    w->next = t->expires;
+    timerarm(w - wheels, w->next);
+  }
+  release(&w->lock);
+  pop_off();
+}
+
+// Take t off its wheel if it hasn't fired yet.
+void
+timerdel(struct timer *t)
+{
+  struct timerwheel *w = t->w;
+
+  if(w == 0)
+    return;
+  acquire(&w->lock);
+  if(t->pending){
+    lst_remove(&t->link);
+    t->pending = 0;
+    w->count--;
+  }
+  release(&w->lock);
+}
+
+static void
+timerwake(struct timer *t)
+{
+  wakeupproc((struct proc*)t->arg, t);
+}
+
+// Sleep until mtime reaches deadline.
+// Returns -1 if the process was killed first, 0 otherwise.
+int
+timersleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+  struct timer t;
+
+  t.expires = deadline;
+  t.fn = timerwake;
+  t.arg = p;
+  t.w = 0;
+  timeradd(&t);
+
+  acquire(&t.w->lock);
+  while(t.pending && !p->killed)
+    sleep(&t, &t.w->lock);
+  release(&t.w->lock);
+
+  timerdel(&t);
+  return p->killed ? -1 : 0;
+}
+
+// Stop this hart's periodic clock tick while it has nothing
+// to run. Only its one-shot timers will interrupt it until
+// tickstart(). Interrupts must be off.
+void
+tickstop(void)
+{
+  int id = cpuid();
+  uint64 *scratch = &mscratch0[32 * id];
+
+  scratch[6] = -1;
+  mycpu()->nexttick = -1;
+  *(volatile uint64*)CLINT_MTIMECMP(id) = scratch[7];
+}
+
+// Restart this hart's periodic clock tick, one tick from now.
+// Interrupts must be off.
+void
+tickstart(void)
+{
+  int id = cpuid();
+  uint64 *scratch = &mscratch0[32 * id];
+  volatile uint64 *cmp = (uint64*)CLINT_MTIMECMP(id);
+  uint64 next = mtime() + CLINT_FREQ / hz;
+
+  scratch[6] = next;
+  mycpu()->nexttick = next;
+  if(next < *cmp)
+    *cmp = next;
+}
+
+// Handle a timer interrupt forwarded by timervec: fire this
+// hart's expired timers and re-arm the one-shot deadline.
+// Returns 1 if a clock tick has passed since the last call.
+int
+timerintr(void)
+{
+  int id = cpuid();
+  struct cpu *c = mycpu();
+  struct timerwheel *w = &wheels[id];
+  uint64 *scratch = &mscratch0[32 * id];
+  int tick = 0;
+
+  if(scratch[6] != c->nexttick){
+    c->nexttick = scratch[6];
+    tick = 1;
+  }
+
+  acquire(&w->lock);
+  runwheel(w, mtime());
+  w->next = earliest(w);
+  timerarm(id, w->next);
+  release(&w->lock);
+
+  return tick;
+}
@@ -0,0 +1,9 @@
+// One-shot timer on a hart's timer wheel; see timer.c.
+struct timer {
+  struct list link;          // slot list in the wheel; must be first
+  uint64 expires;            // mtime deadline
+  void (*fn)(struct timer*); // called at expiry, wheel lock held
+  void *arg;                 // for fn
+  int pending;               // still on the wheel?
+  struct timerwheel *w;      // wheel the timer was added to
+};
@@ -6,7 +6,7 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
+struct seqlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
@@ -22,7 +22,7 @@ scause_desc(uint64 stval);
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initseqlock(&tickslock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -53,6 +53,9 @@ usertrap(void)
   // save user program counter.
   p->tf->epc = r_sepc();
 
+  // p ran in user space since usertrapret().
+  cpucharge(p, CPU_USER);
+
   //increase process token
   p->cpu_tokens++;
   
@@ -104,6 +107,9 @@ usertrapret(void)
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
+  // kernel time ends here; user time starts.
+  cpucharge(p, CPU_SYS);
+
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
   p->tf->kernel_satp = r_satp();         // kernel page table
@@ -130,7 +136,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -164,24 +170,34 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// bring ticks up to date with mtime. any hart with a
+// running clock tick calls this, since an idle hart 0
+// no longer takes clock interrupts.
 void
 clockintr()
 {
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
+  uint now = mtime() / (CLINT_FREQ / hz);
+
+  // every hart with a clock tick gets here each tick, but only
+  // the first to see the new tick needs to write.
+  if(now <= ticks)
+    return;
+  write_seqlock(&tickslock);
+  if(now > ticks)
+    ticks = now;
+  write_sequnlock(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if a clock tick,
 // 1 if other device,
 // 0 if not recognized.
 int
 devintr()
 {
   uint64 scause = r_scause();
+  int tick;
 
   if((scause & 0x8000000000000000L) &&
      (scause & 0xff) == 9){
@@ -205,17 +221,25 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or a kick from another hart, forwarded by timervec in
+    // kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip. do it first, so that a timer
+    // re-armed below can't get lost.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // it may be a clock tick, a one-shot timer deadline, a kick
+    // from another hart, or several of these. a kick ends the
+    // scheduler's wfi, or preempts the running process if the
+    // kicker asked for that with needresched().
+    tick = timerintr();
+    if(tick)
+      clockintr();
+
+    if(needresched() || tick)
+      return 2;
+    return 1;
   } else {
     return 0;
   }
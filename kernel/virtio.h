@@ -44,6 +44,9 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
+// offset of num_queues in the disk's configuration space
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES 34
+
 struct virtq_desc {
   uint64 addr;
   uint32 len;
@@ -52,11 +55,12 @@ struct virtq_desc {
 };
 #define VIRTQ_DESC_F_NEXT  1 // chained with another descriptor
 #define VIRTQ_DESC_F_WRITE 2 // device writes (vs read)
+#define VIRTQ_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 struct virtq_avail {
   uint16 flags;
   uint16 idx;
-  uint16 ring[];
+  uint16 ring[];  // then used_event, with VIRTIO_RING_F_EVENT_IDX
 };
 #define VIRTQ_AVAIL_F_NO_INTERRUPT 1 // suppress interrupts
 
@@ -69,8 +73,22 @@ struct virtq_used_elem {
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
+// the first descriptor of a disk op points to one of these.
+struct virtio_blk_outhdr {
+  uint32 type;
+  uint32 reserved;
+  uint64 sector;
+};
+
 struct virtq_used {
   uint16 flags;
   uint16 idx;
-  struct virtq_used_elem ring[];
+  struct virtq_used_elem ring[]; // then avail_event, with VIRTIO_RING_F_EVENT_IDX
 };
+#define VIRTQ_USED_F_NO_NOTIFY 1 // device doesn't want notifying
+
+// with VIRTIO_RING_F_EVENT_IDX, the other side wants to hear
+// about index event: must it, when the index goes from old
+// to new?
+#define virtq_need_event(event, new, old) \
+  ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
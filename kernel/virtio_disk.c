@@ -3,7 +3,18 @@
 // uses qemu's mmio interface to virtio.
 // qemu presents a "legacy" virtio interface.
 //
-// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0,num-queues=N
+//
+// with VIRTIO_BLK_F_MQ the device has several request queues,
+// each with its own lock; a hart submits on queue cpuid() % nq,
+// so harts don't contend for one driver lock. the device has
+// one interrupt, whose handler looks at every queue.
+//
+// with polling turned on for a disk (diskpoll()), a waiter
+// spins on the used ring for about as long as the device has
+// lately been taking, before it sleeps for the interrupt;
+// short synchronous I/O then skips the interrupt, wakeup and
+// scheduler.
 //
 
 #include "types.h"
@@ -16,41 +27,113 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "stat.h"
+#include "proc.h"
 
 // the address of virtio mmio register r.
 #define R(n, r) ((volatile uint32 *)(VIRTION(n) + (r)))
 
-// this many virtio descriptors.
+// the most virtio descriptors, over all of a disk's queues; a
+// queue gets its share, or fewer if the device allows fewer.
 // must be a power of two.
-#define NUM 8
+#define NUMMAX 256
+
+// the most request queues used on one disk.
+#define NQUEUE NCPU
+
+// the most blocks merged into one request.
+#define MAXSEG 16
+
+// longest a waiter polls, and the slowest recent device
+// latency at which it still does: 100us.
+#define POLLMAX (CLINT_FREQ / 10000)
+
+// bytes of ring memory for a queue of num descriptors, in the
+// legacy layout: descriptors, then the avail ring (with
+// used_event), then, on the next page, the used ring (with
+// avail_event).
+#define RINGUSED(num) PGROUNDUP((num)*sizeof(struct virtq_desc) + (3+(num))*sizeof(uint16))
+#define RINGSIZE(num) (RINGUSED(num) + PGROUNDUP((3*sizeof(uint16)) + (num)*sizeof(struct virtq_used_elem)))
+
+// enough for every queue's share of NUMMAX, however many there
+// are; a lone queue of NUMMAX takes less than this.
+#define RINGPAGES (NQUEUE * RINGSIZE(NUMMAX / NQUEUE))
+
+// track info about in-flight operations,
+// for use when completion interrupt arrives.
+// indexed by first descriptor index of chain.
+// with indirect descriptors, an op takes one descriptor in
+// the ring, pointing at its table here.
+struct vqinfo {
+  struct buf *b; // the op's bufs, in block order, through qnext
+  char status;
+  uint64 start;  // mtime() at submit
+  struct virtio_blk_outhdr hdr;
+  struct virtq_desc table[MAXSEG+2];
+};
+
+// one request queue.
+struct vq {
+  struct spinlock lock;
 
-struct disk {
-  // memory for virtio descriptors &c for queue 0.
-  // this is a global instead of allocated because it has
-  // to be multiple contiguous pages, which kalloc()
-  // doesn't support.
-  char pages[2*PGSIZE];
-  
   struct virtq_desc *desc;
   struct virtq_avail *avail;
   struct virtq_used *used;
+  uint16 *used_event; // at the end of avail, with event_idx
+  uint16 *avail_event; // at the end of used, with event_idx
+  int num;        // descriptors in the queue
 
   // our own book-keeping.
-  char free[NUM];  // is a descriptor free?
+  uint16 free[NUMMAX]; // stack of free descriptors
+  int nfree;
   uint16 used_idx; // we've looked this far in used->ring.
+  struct vqinfo *info; // num of them, in disk's info[]
+
+  // bufs waiting to be made into ops, in block order, through
+  // qnext, for when the ring is full. a process that wants
+  // bufs for adjacent blocks to go as one op gathers them
+  // under virtio_disk_plug() first.
+  struct buf *pending;
+  int npending;
+  uint pos;       // block after the last op sent, for the elevator
+
+  // queue depth and completions, for diskstat().
+  uint depth;      // requests in flight
+  uint maxdepth;
+  uint64 depthsum; // depth just after each submit, summed
+  uint nsubmit;
+  uint nqfull;     // times ops had to wait for descriptors
+  uint nmerge;     // bufs that went in another's op
+  uint nread;      // completed requests
+  uint nwrite;
+  uint nnotify;    // times the device was notified
+
+  // latencies, for polling and diskstat().
+  uint64 devlat;   // device latency, moving average, in mtime() ticks
+  uint npoll;      // waits that polling finished
+  uint npollmiss;  // waits that polled, then slept
+  uint lat[NLAT];  // wait latencies, by power of two microseconds
+};
 
-  // track info about in-flight operations,
-  // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
-  struct {
-    struct buf *b;
-    char status;
-  } info[NUM];
+struct disk {
+  // memory for virtio descriptors &c for the queues. this is
+  // a global instead of allocated because each queue's has to
+  // be multiple contiguous pages, which kalloc() doesn't
+  // support.
+  char pages[RINGPAGES];
+  struct vqinfo info[NUMMAX];
+
+  struct vq q[NQUEUE];
+  int nq;         // queues in use
+
+  int indirect;   // VIRTIO_RING_F_INDIRECT_DESC negotiated?
+  int event_idx;  // VIRTIO_RING_F_EVENT_IDX negotiated?
 
   // initialized?
   int init;
 
-  struct spinlock vdisk_lock;
+  int poll;       // waiters poll before sleeping?
+  uint nintr;     // completion interrupts; atomic
 } __attribute__ ((aligned (PGSIZE))) disk[NDISK];
   
 
@@ -59,6 +142,8 @@ void
 virtio_disk_init(int n)
 {
   uint32 status = 0;
+  int nq, num, q, off, ninfo;
+  struct vq *vq;
 
   __sync_synchronize();
   if(disk[n].init)
@@ -66,8 +151,6 @@ virtio_disk_init(int n)
 
   printf("virtio disk init %d\n", n);
   
-  initlock(&disk[n].vdisk_lock, "virtio_disk");
-
   if(*R(n, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(n, VIRTIO_MMIO_VERSION) != 1 ||
      *R(n, VIRTIO_MMIO_DEVICE_ID) != 2 ||
@@ -86,11 +169,19 @@ virtio_disk_init(int n)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(n, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk[n].indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+  disk[n].event_idx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+
+  nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ))
+    nq = *(volatile uint16 *)(VIRTION(n) + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+  if(nq < 1)
+    nq = 1;
+  if(nq > NQUEUE)
+    nq = NQUEUE;
+  disk[n].nq = nq;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -102,184 +193,617 @@ virtio_disk_init(int n)
 
   *R(n, VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
-  // initialize queue 0.
-  *R(n, VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(n, VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-  *R(n, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  // initialize the queues, each as large as the device and its
+  // share of NUMMAX allow.
   memset(disk[n].pages, 0, sizeof(disk[n].pages));
-  *R(n, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk[n].pages) >> PGSHIFT;
-
-  // desc = pages -- num * virtq_desc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * virtq_used_elem
-
-  disk[n].desc = (struct virtq_desc *) disk[n].pages;
-  disk[n].avail = (struct virtq_avail *)(((char*)disk[n].desc) + NUM*sizeof(struct virtq_desc));
-  disk[n].used = (struct virtq_used *) (disk[n].pages + PGSIZE);
-
-  for(int i = 0; i < NUM; i++)
-    disk[n].free[i] = 1;
+  off = 0;
+  ninfo = 0;
+  for(q = 0; q < nq; q++){
+    vq = &disk[n].q[q];
+    initlock(&vq->lock, "virtio_disk");
+    *R(n, VIRTIO_MMIO_QUEUE_SEL) = q;
+    uint32 max = *R(n, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if(max == 0)
+      panic("virtio disk has no queue");
+    if(max < 3)
+      panic("virtio disk max queue too short");
+    num = NUMMAX;
+    while(num > max || num * nq > NUMMAX)
+      num /= 2;
+    if(off + RINGSIZE(num) > sizeof(disk[n].pages))
+      panic("virtio disk rings");
+    vq->num = num;
+    *R(n, VIRTIO_MMIO_QUEUE_NUM) = num;
+    *R(n, VIRTIO_MMIO_QUEUE_ALIGN) = PGSIZE;
+    *R(n, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk[n].pages + off) >> PGSHIFT;
+
+    // desc = ring -- num * virtq_desc
+    // avail = ring + num*16 -- 2 * uint16, num * uint16, used_event
+    // used = next page -- 2 * uint16, num * virtq_used_elem, avail_event
+
+    vq->desc = (struct virtq_desc *) (disk[n].pages + off);
+    vq->avail = (struct virtq_avail *)(((char*)vq->desc) + num*sizeof(struct virtq_desc));
+    vq->used = (struct virtq_used *) (disk[n].pages + off + RINGUSED(num));
+    vq->used_event = &vq->avail->ring[num];
+    vq->avail_event = (uint16 *) &vq->used->ring[num];
+    off += RINGSIZE(num);
+
+    vq->info = &disk[n].info[ninfo];
+    ninfo += num;
+
+    for(int i = 0; i < num; i++)
+      vq->free[i] = num - 1 - i;
+    vq->nfree = num;
+  }
 
   disk[n].init = 1;
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
+// the queue this hart submits on.
+static struct vq*
+myqueue(int n)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  return &disk[n].q[id % disk[n].nq];
+}
+
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc(int n)
+alloc_desc(struct vq *vq)
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk[n].free[i]){
-      disk[n].free[i] = 0;
-      return i;
-    }
-  }
-  return -1;
+  if(vq->nfree == 0)
+    return -1;
+  return vq->free[--vq->nfree];
 }
 
 // mark a descriptor as free.
 static void
-free_desc(int n, int i)
+free_desc(struct vq *vq, int i)
 {
-  if(i >= NUM)
+  if(i >= vq->num)
     panic("virtio_disk_intr 1");
-  if(disk[n].free[i])
+  if(vq->desc[i].addr == 0)
     panic("virtio_disk_intr 2");
-  disk[n].desc[i].addr = 0;
-  disk[n].free[i] = 1;
-  wakeup(&disk[n].free[0]);
+  vq->desc[i].addr = 0;
+  vq->free[vq->nfree++] = i;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int n, int i)
+free_chain(struct vq *vq, int i)
 {
   while(1){
-    free_desc(n, i);
-    if(disk[n].desc[i].flags & VIRTQ_DESC_F_NEXT)
-      i = disk[n].desc[i].next;
+    int flags = vq->desc[i].flags;
+    int next = vq->desc[i].next;
+    free_desc(vq, i);
+    if(flags & VIRTQ_DESC_F_NEXT)
+      i = next;
     else
       break;
   }
 }
 
+// allocate k descriptors, chained in idx order.
 static int
-alloc3_desc(int n, int *idx)
+allocn_desc(struct vq *vq, int *idx, int k)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc(n);
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(n, idx[j]);
-      return -1;
-    }
-  }
+  if(vq->nfree < k)
+    return -1;
+  for(int i = 0; i < k; i++)
+    idx[i] = alloc_desc(vq);
   return 0;
 }
 
-void
-virtio_disk_rw(int n, struct buf *b, int write)
+// send the device one op on queue vq of disk n, for the k bufs
+// starting at b, which are for consecutive blocks and are all
+// reads or all writes. returns -1 if there are not enough free
+// descriptors. caller holds vq->lock.
+static int
+submit(int n, struct vq *vq, struct buf *b, int k)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk[n].vdisk_lock);
-
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(n, idx) == 0) {
-      break;
-    }
-    sleep(&disk[n].free[0], &disk[n].vdisk_lock);
+  struct virtq_desc *d;
+  struct buf *bp;
+  uint16 old;
+  int idx[MAXSEG+2], id, i;
+
+  // the spec says that legacy block operations use a
+  // descriptor for type/reserved/sector, then one for each
+  // run of data, then one for a 1-byte status result. with
+  // indirect descriptors, those are in a table in info[], and
+  // the op takes up just one descriptor in the ring.
+
+  if(disk[n].indirect){
+    if((id = alloc_desc(vq)) < 0)
+      return -1;
+    d = vq->info[id].table;
+    vq->desc[id].addr = (uint64) d;
+    vq->desc[id].len = (k+2)*sizeof(struct virtq_desc);
+    vq->desc[id].flags = VIRTQ_DESC_F_INDIRECT;
+    vq->desc[id].next = 0;
+    for(i = 0; i < k+2; i++)
+      idx[i] = i;
+  } else {
+    if(allocn_desc(vq, idx, k+2) < 0)
+      return -1;
+    d = vq->desc;
+    id = idx[0];
   }
   
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &vq->info[id].hdr;
 
-  if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+  if(b->iowrite)
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk[n].desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk[n].desc[idx[0]].len = sizeof(buf0);
-  disk[n].desc[idx[0]].flags = VIRTQ_DESC_F_NEXT;
-  disk[n].desc[idx[0]].next = idx[1];
-
-  disk[n].desc[idx[1]].addr = (uint64) b->data;
-  disk[n].desc[idx[1]].len = BSIZE;
-  if(write)
-    disk[n].desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk[n].desc[idx[1]].flags = VIRTQ_DESC_F_WRITE; // device writes b->data
-  disk[n].desc[idx[1]].flags |= VIRTQ_DESC_F_NEXT;
-  disk[n].desc[idx[1]].next = idx[2];
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  // the header lives in disk[n] rather than on the caller's
+  // stack, since the caller need not wait for the op.
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(*buf0);
+  d[idx[0]].flags = VIRTQ_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
+
+  for(i = 1, bp = b; i <= k; i++, bp = bp->qnext){
+    d[idx[i]].addr = (uint64) bp->data;
+    d[idx[i]].len = BSIZE;
+    if(b->iowrite)
+      d[idx[i]].flags = 0; // device reads bp->data
+    else
+      d[idx[i]].flags = VIRTQ_DESC_F_WRITE; // device writes bp->data
+    d[idx[i]].flags |= VIRTQ_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
 
-  disk[n].info[idx[0]].status = 0;
-  disk[n].desc[idx[2]].addr = (uint64) &disk[n].info[idx[0]].status;
-  disk[n].desc[idx[2]].len = 1;
-  disk[n].desc[idx[2]].flags = VIRTQ_DESC_F_WRITE; // device writes the status
-  disk[n].desc[idx[2]].next = 0;
+  vq->info[id].status = 0;
+  d[idx[k+1]].addr = (uint64) &vq->info[id].status;
+  d[idx[k+1]].len = 1;
+  d[idx[k+1]].flags = VIRTQ_DESC_F_WRITE; // device writes the status
+  d[idx[k+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk[n].info[idx[0]].b = b;
+  // record the bufs for virtio_disk_intr().
+  vq->info[id].b = b;
+  vq->info[id].start = mtime();
 
   // avail->idx tells the device how far to look in avail->ring.
   // avail->ring[...] are desc[] indices the device should process.
   // we only tell device the first index in our chain of descriptors.
-  disk[n].avail->ring[disk[n].avail->idx % NUM] = idx[0];
+  old = vq->avail->idx;
+  vq->avail->ring[old % vq->num] = id;
   __sync_synchronize();
-  disk[n].avail->idx += 1;
+  vq->avail->idx = old + 1;
+  __sync_synchronize();
+
+  // a device that is still working through the ring will find
+  // this op without being told; with event_idx it says so in
+  // avail_event.
+  if(disk[n].event_idx ? virtq_need_event(*vq->avail_event, old + 1, old)
+                       : !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY)){
+    *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = vq - disk[n].q; // value is queue number
+    vq->nnotify++;
+  }
 
-  *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  vq->depth++;
+  if(vq->depth > vq->maxdepth)
+    vq->maxdepth = vq->depth;
+  vq->depthsum += vq->depth;
+  vq->nsubmit++;
+  vq->nmerge += k - 1;
+  return 0;
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk[n].vdisk_lock);
+// turn vq's pending bufs into ops, for as long as there are
+// descriptors. an elevator: ops go out in block order, from
+// where the last one left off, wrapping around to the lowest
+// block, and each takes the longest run of consecutive blocks
+// there is, up to MAXSEG. caller holds vq->lock.
+static void
+dispatch(int n, struct vq *vq)
+{
+  struct buf *b, *prev, *last, *rest;
+  int k, maxseg;
+
+  // without indirect descriptors, an op takes 2 descriptors
+  // besides one per block, and must fit in the ring.
+  maxseg = MAXSEG;
+  if(!disk[n].indirect && maxseg > vq->num - 2)
+    maxseg = vq->num - 2;
+
+  while(vq->pending){
+    prev = 0;
+    for(b = vq->pending; b && b->blockno < vq->pos; b = b->qnext)
+      prev = b;
+    if(b == 0){
+      prev = 0;
+      b = vq->pending;
+    }
+    for(k = 1, last = b; k < maxseg && last->qnext; k++, last = last->qnext)
+      if(last->qnext->blockno != last->blockno + 1 || last->qnext->iowrite != b->iowrite)
+        break;
+
+    // take b through last off the pending list for submit().
+    rest = last->qnext;
+    if(prev)
+      prev->qnext = rest;
+    else
+      vq->pending = rest;
+    last->qnext = 0;
+    if(submit(n, vq, b, k) < 0){
+      last->qnext = rest;
+      if(prev)
+        prev->qnext = b;
+      else
+        vq->pending = b;
+      vq->nqfull++;
+      break;
+    }
+    vq->npending -= k;
+    vq->pos = last->blockno + 1;
   }
+}
 
-  disk[n].info[idx[0]].b = 0;
-  free_chain(n, idx[0]);
+// put b on the sorted list *head.
+static void
+sortin(struct buf **head, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = head; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+}
 
-  release(&disk[n].vdisk_lock);
+// put the bufs on list, which are for disk n, on this hart's
+// queue, and send them on their way.
+static void
+enqueue(int n, struct buf *list)
+{
+  struct vq *vq;
+  struct buf *b;
+
+  vq = myqueue(n);
+  acquire(&vq->lock);
+  while((b = list) != 0){
+    list = b->qnext;
+    b->iq = vq - disk[n].q;
+    sortin(&vq->pending, b);
+    vq->npending++;
+  }
+  dispatch(n, vq);
+  release(&vq->lock);
 }
 
+// send the bufs p's plug has held back to their disks' queues.
+static void
+flushplug(struct proc *p)
+{
+  struct buf *b, *next, *list, **pp;
+
+  while((list = p->plug) != 0){
+    // take the bufs for list's disk off p->plug, in order.
+    p->plug = 0;
+    pp = &list;
+    for(b = list; b; b = next){
+      next = b->qnext;
+      if(b->dev == list->dev){
+        *pp = b;
+        pp = &b->qnext;
+      } else {
+        sortin(&p->plug, b);
+      }
+    }
+    *pp = 0;
+    enqueue(list->dev, list);
+  }
+}
+
+// Queue a disk op on b and return without waiting for it. When
+// it is done, the disk interrupt calls b->iodone(b), or if that
+// is 0 marks b for virtio_disk_wait(). Many ops may be in
+// flight at once.
 void
-virtio_disk_intr(int n)
+virtio_disk_start(int n, struct buf *b, int write)
+{
+  struct proc *p = myproc();
+
+  b->disk = 1;
+  b->iowrite = write;
+  b->iostart = mtime();
+  b->qnext = 0;
+  if(p && p->nplug > 0){
+    b->iq = -1; // on p->plug
+    sortin(&p->plug, b);
+    return;
+  }
+  enqueue(n, b);
+}
+
+// Like virtio_disk_start(), but start nothing and return -1
+// if the queue is backed up, for I/O that may as well be skipped.
+int
+virtio_disk_trystart(int n, struct buf *b, int write)
+{
+  struct vq *vq = myqueue(n);
+
+  // only a hint, read without vq->lock: the queue may fill or
+  // drain right after, which costs at most one late or skipped
+  // readahead.
+  if(__atomic_load_n(&vq->npending, __ATOMIC_RELAXED) >= vq->num)
+    return -1;
+  virtio_disk_start(n, b, write);
+  return 0;
+}
+
+// finish the ops the device has completed on vq, and send it
+// more if they freed descriptors. from the interrupt, or from a
+// polling waiter. caller holds vq->lock.
+static void
+complete(int n, struct vq *vq)
 {
-  acquire(&disk[n].vdisk_lock);
+  struct buf *b, *next;
+  uint64 lat;
+
+  // with event_idx, used_event asks for an interrupt at the
+  // next completion after the ones handled here; look again
+  // after setting it, for completions that slipped in between.
+  do {
+    while(vq->used_idx != vq->used->idx){
+      __sync_synchronize();
+      int id = vq->used->ring[vq->used_idx % vq->num].id;
+
+      if(vq->info[id].status != 0)
+        panic("virtio_disk_intr status");
+  
+      if(vq->info[id].hdr.type == VIRTIO_BLK_T_OUT)
+        vq->nwrite++;
+      else
+        vq->nread++;
+      vq->depth--;
+      lat = mtime() - vq->info[id].start;
+      if(vq->devlat == 0)
+        vq->devlat = lat;
+      else
+        vq->devlat = (vq->devlat * 7 + lat) / 8;
+      free_chain(vq, id);
+
+      for(b = vq->info[id].b; b; b = next){
+        next = b->qnext;
+        b->qnext = 0;
+        b->disk = 0;   // disk is done with buf
+        if(b->iodone)
+          b->iodone(b);
+        else
+          wakeup(b);
+      }
+      vq->info[id].b = 0;
+
+      vq->used_idx += 1;
+    }
+    if(disk[n].event_idx)
+      *vq->used_event = vq->used_idx;
+    __sync_synchronize();
+  } while(vq->used_idx != vq->used->idx);
 
-  while((disk[n].used_idx % NUM) != (disk[n].used->idx % NUM)){
-    int id = disk[n].used->ring[disk[n].used_idx].id;
+  // descriptors have been freed for ops that didn't fit.
+  dispatch(n, vq);
+}
 
-    if(disk[n].info[id].status != 0)
-      panic("virtio_disk_intr status");
-    
-    disk[n].info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk[n].info[id].b);
+// how long a waiter on vq polls: twice the device's recent
+// latency, or 0 if the device is too slow for polling to pay.
+static uint64
+pollbudget(struct vq *vq)
+{
+  if(vq->devlat == 0)
+    return POLLMAX;
+  if(vq->devlat > POLLMAX)
+    return 0;
+  return vq->devlat * 2 > POLLMAX ? POLLMAX : vq->devlat * 2;
+}
 
-    disk[n].used_idx = (disk[n].used_idx + 1) % NUM;
+// Wait for the op started on b with b->iodone 0 to finish.
+// If b is held back by the caller's plug, the plug's bufs
+// go to the device now.
+void
+virtio_disk_wait(int n, struct buf *b)
+{
+  struct vq *vq;
+  uint64 end, t;
+  int i;
+
+  if(b->iq < 0)
+    flushplug(myproc());
+  if(b->iq < 0)
+    panic("virtio_disk_wait: plugged by another");
+  vq = &disk[n].q[b->iq];
+
+  acquire(&vq->lock);
+  if(b->disk == 1 && disk[n].poll && (t = pollbudget(vq)) > 0){
+    // spin without the lock, so the interrupt handler and other
+    // waiters can get at the queue, and take it only to reap
+    // completions. the interrupt still comes, and finds them
+    // gone.
+    release(&vq->lock);
+    end = mtime() + t;
+    while(*(volatile int*)&b->disk == 1 && mtime() < end){
+      if(*(volatile uint16*)&vq->used->idx != vq->used_idx){
+        acquire(&vq->lock);
+        complete(n, vq);
+        release(&vq->lock);
+      }
+    }
+    acquire(&vq->lock);
+    if(b->disk == 1)
+      vq->npollmiss++;
+    else
+      vq->npoll++;
   }
+  while(b->disk == 1)
+    sleep(b, &vq->lock);
+
+  t = (mtime() - b->iostart) / (CLINT_FREQ / 1000000);
+  for(i = 0; i < NLAT-1 && t >= 2; i++)
+    t /= 2;
+  vq->lat[i]++;
+  release(&vq->lock);
+}
+
+// Turn polling on disk n on (on 1) or off (on 0). Returns
+// the old setting, or -1 if there is no such disk.
+int
+diskpoll(int n, int on)
+{
+  int old;
+
+  if(n < 0 || n >= NDISK || !disk[n].init)
+    return -1;
+  old = disk[n].poll;
+  disk[n].poll = on != 0;
+  return old;
+}
 
-  release(&disk[n].vdisk_lock);
+void
+virtio_disk_rw(int n, struct buf *b, int write)
+{
+  b->iodone = 0;
+  virtio_disk_start(n, b, write);
+  virtio_disk_wait(n, b);
 }
 
+// Hold back the ops the calling process starts, on a list of
+// its own, until the matching virtio_disk_unplug(), so that
+// those for adjacent blocks can be merged. For a burst of I/O
+// that is started together, such as a log commit. Other
+// processes' I/O is not held up, and if the process waits for
+// one of its plugged ops, they all go at once.
+void
+virtio_disk_plug(int n)
+{
+  struct proc *p = myproc();
+
+  if(p)
+    p->nplug++;
+}
+
+void
+virtio_disk_unplug(int n)
+{
+  struct proc *p = myproc();
+
+  if(p && --p->nplug == 0)
+    flushplug(p);
+}
+
+// Copy out queue statistics of up to n disks, summed over
+// their queues, to addr. Returns the number copied.
+int
+diskstat(uint64 addr, int n)
+{
+  struct diskstat st;
+  struct vq *vq;
+  int i, k, k2;
+
+  k = 0;
+  for(i = 0; i < NDISK && k < n; i++){
+    if(!disk[i].init)
+      continue;
+    memset(&st, 0, sizeof(st));
+    st.disk = i;
+    st.nqueue = disk[i].nq;
+    st.poll = disk[i].poll;
+    for(vq = disk[i].q; vq < &disk[i].q[disk[i].nq]; vq++){
+      acquire(&vq->lock);
+      st.depth += vq->depth;
+      st.maxdepth += vq->maxdepth;
+      st.depthsum += vq->depthsum;
+      st.nsubmit += vq->nsubmit;
+      st.nqfull += vq->nqfull;
+      st.nmerge += vq->nmerge;
+      st.nread += vq->nread;
+      st.nwrite += vq->nwrite;
+      st.nnotify += vq->nnotify;
+      st.npoll += vq->npoll;
+      st.npollmiss += vq->npollmiss;
+      st.devlat += vq->devlat;
+      for(k2 = 0; k2 < NLAT; k2++)
+        st.lat[k2] += vq->lat[k2];
+      release(&vq->lock);
+    }
+    st.nintr = disk[i].nintr;
+    st.devlat = st.devlat / disk[i].nq / (CLINT_FREQ / 1000000);
+    if(copyout(myproc()->pagetable, addr + k*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    k++;
+  }
+  return k;
+}
+
+#define BENCHDEPTH 4 // reads each diskbench() caller keeps in flight
+
+// Read random blocks of the root disk straight from the device, not
+// through the buffer cache, for cycles or until the process is
+// killed, keeping BENCHDEPTH reads in flight. Returns the number
+// of reads done, or -1. For measuring the driver, on as many
+// harts as want to.
+int
+diskbench(uint64 cycles)
+{
+  struct buf *b[BENCHDEPTH];
+  uint64 end;
+  uint seed;
+  int i, nb, done;
+
+  for(nb = 0; nb < BENCHDEPTH; nb++){
+    if((b[nb] = kalloc()) == 0)
+      break;
+    memset(b[nb], 0, sizeof(struct buf));
+    initsleeplocknostat(&b[nb]->lock, "diskbench");
+  }
+
+  seed = myproc()->pid * 1103515245 + 12345;
+  done = 0;
+  end = mtime() + cycles;
+  for(i = 0; nb > 0 && mtime() < end && !myproc()->killed; i = (i + 1) % nb){
+    if(b[i]->disk){
+      virtio_disk_wait(ROOTDEV, b[i]);
+      done++;
+    }
+    seed = seed * 1103515245 + 12345;
+    b[i]->dev = ROOTDEV;
+    b[i]->blockno = (seed >> 8) % FSSIZE;
+    b[i]->iodone = 0;
+    virtio_disk_start(ROOTDEV, b[i], 0);
+  }
+  for(i = 0; i < nb; i++){
+    if(b[i]->disk){
+      virtio_disk_wait(ROOTDEV, b[i]);
+      done++;
+    }
+    kfree(b[i]);
+  }
+  return nb > 0 ? done : -1;
+}
+
+void
+virtio_disk_intr(int n)
+{
+  struct vq *vq;
+
+  __sync_fetch_and_add(&disk[n].nintr, 1);
+
+  for(vq = disk[n].q; vq < &disk[n].q[disk[n].nq]; vq++){
+    acquire(&vq->lock);
+    complete(n, vq);
+    release(&vq->lock);
+  }
+}
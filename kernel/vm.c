@@ -128,6 +128,24 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// map a kernel stack page at va in the kernel page table.
+// unlike kvmmap(), used after boot, so it fails instead of
+// panicking if a page-table page can't be allocated.
+// caller must serialize changes to the kernel page table.
+int
+kvmmapstack(uint64 va, uint64 pa)
+{
+  return mappages(kernel_pagetable, va, PGSIZE, pa, PTE_R | PTE_W);
+}
+
+// unmap the kernel stack page at va and free it.
+// does not flush the TLB; see kstackgen in proc.c.
+void
+kvmunmapstack(uint64 va)
+{
+  uvmunmap(kernel_pagetable, va, PGSIZE, 1);
+}
+
 // translate a kernel virtual address to
 // a physical address. only needed for
 // addresses on the stack.
@@ -208,13 +226,14 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 }
 
 // create an empty user page table.
+// returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
   pagetable = (pagetable_t) kalloc();
   if(pagetable == 0)
-    panic("uvmcreate: out of memory");
+    return 0;
   memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
@@ -306,7 +325,8 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  uvmunmap(pagetable, 0, sz, 1);
+  if(sz > 0)
+    uvmunmap(pagetable, 0, sz, 1);
   freewalk(pagetable);
 }
 
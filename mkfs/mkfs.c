@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = FSLOGSIZE;  // log blocks, header included; mkfs -l n
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -76,8 +76,19 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  // the header and the kernel's smallest and largest logs.
+  if(nlog < 1 + MAXOPBLOCKS || nlog > 1 + LOGSIZE){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n",
+            1 + MAXOPBLOCKS, 1 + LOGSIZE);
     exit(1);
   }
 
@@ -0,0 +1,56 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "user/user.h"
+
+#define NSTAT (NPROC + NCONTAINERS)
+#define CYCLES_PER_MS (CLINT_FREQ / 1000)
+#define CYCLES_PER_US (CLINT_FREQ / 1000000)
+
+// too big for the user stack.
+struct cpustat st[NSTAT];
+
+// average wakeup-to-running latency of st, in microseconds.
+static int
+wakeavg(struct cpustat *st)
+{
+  if(st->nwakeup == 0)
+    return 0;
+  return (int)(st->wakesum / st->nwakeup / CYCLES_PER_US);
+}
+
+// print cpu time per process, then per container, in milliseconds,
+// and wakeup latency in microseconds.
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  if((n = cpustat(st, NSTAT)) < 0){
+    fprintf(2, "cpustat failed\n");
+    exit(1);
+  }
+  printf("PID\tNAME\tCONTAINER\tUSER(ms)\tSYS(ms)\tWAIT(ms)\tMIGR\tWAKE(us)\tMAX(us)\n");
+  for(i = 0; i < n; i++){
+    if(st[i].pid == 0)
+      continue;
+    printf("%d\t%s\t%s\t\t%d\t\t%d\t%d\t\t%d\t%d\t\t%d\n", st[i].pid, st[i].name, st[i].cname,
+           (int)(st[i].user / CYCLES_PER_MS), (int)(st[i].sys / CYCLES_PER_MS),
+           (int)(st[i].wait / CYCLES_PER_MS), st[i].nmigrate,
+           wakeavg(&st[i]), (int)(st[i].wakemax / CYCLES_PER_US));
+  }
+  printf("\nCONTAINER\tUSER(ms)\tSYS(ms)\tWAIT(ms)\tWAKE(us)\tMAX(us)\n");
+  for(i = 0; i < n; i++){
+    if(st[i].pid != 0)
+      continue;
+    printf("%s\t\t%d\t\t%d\t%d\t\t%d\t\t%d\n", st[i].cname,
+           (int)(st[i].user / CYCLES_PER_MS), (int)(st[i].sys / CYCLES_PER_MS),
+           (int)(st[i].wait / CYCLES_PER_MS),
+           wakeavg(&st[i]), (int)(st[i].wakemax / CYCLES_PER_US));
+  }
+  exit(0);
+}
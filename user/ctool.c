@@ -9,17 +9,20 @@
 #include "user/user.h"
 
 #define COMMMANDSZ 15
-#define TOOLSZ 6
+#define TOOLSZ 9
 //reference
-enum CTOOLS { CCREATE, CINFO, CPAUSE, CRESUME, CSTART, CSTOP };
-//six possible ctool commands to run
+enum CTOOLS { CCREATE, CINFO, CPAUSE, CRESUME, CSTART, CSTOP, CPIN, CSETWEIGHT, CSETRT };
+//nine possible ctool commands to run
 static char *tools[TOOLSZ] = {
     [CCREATE]    "create\0",
     [CINFO]  "info\0",
     [CPAUSE]  "pause\0",
     [CRESUME]   "resume\0",
     [CSTART]    "start\0",
-    [CSTOP] "stop\0"
+    [CSTOP] "stop\0",
+    [CPIN] "pin\0",
+    [CSETWEIGHT] "weight\0",
+    [CSETRT] "rt\0"
 };
 //reference
 enum COMMANDS { CAT, COUNTER, ECHO, FORK, GREP, KILL, LN, LS, MKDIR, PS, RESUME, RM, SH, STRACE, SUSPEND };
@@ -66,7 +69,7 @@ void
 error(void)
 {
     printf(
-    "ctool needs a command and its options/arguments\nctool <cmd> <arg(s)>\nctool <create> <container> <program(s)>\nctool <info>\nctool <pause> <container>\nctool <resume <container>\nctool <start> <vcN> <container> <program>\n"
+    "ctool needs a command and its options/arguments\nctool <cmd> <arg(s)>\nctool <create> <container> <program(s)>\nctool <info>\nctool <pause> <container>\nctool <resume <container>\nctool <start> [-cpus <list>] <vcN> <container> <program>\nctool <pin> <container> <list>\nctool <weight> <container> <weight>\nctool <rt> <container> <runtime us> <period us>\n<list> is a set of harts like 0,2-3\n"
     );
     exit(-1);
 }
@@ -193,7 +196,17 @@ tresume(int argc, char ** argv)
 void
 tstart(int argc, char ** argv)
 {
-    int end = 3;
+    int end = 3, mask = 0;
+    if (argc > end && strcmp(argv[0], "-cpus") == 0)
+    {
+        if ((mask = cpumask(argv[1])) < 0)
+        {
+            printf("invalid cpu list <%s>\n", argv[1]);
+            error();
+        }
+        argc -= 2;
+        argv += 2;
+    }
     if (argc < end) error();
     int vcn = 0, container = 1, program = 2, fd, id, pid;
 
@@ -239,7 +252,7 @@ tstart(int argc, char ** argv)
             dup(fd);
             dup(fd);
             dup(fd);
-            if (cstart(fd, argv[vcn], argv[container], rootpath, argv[program]) < 0)
+            if (cstart(fd, argv[vcn], argv[container], rootpath, argv[program], mask) < 0)
             {
                 printf("could not start a container\n");
                 error();
@@ -262,6 +275,47 @@ tstop(int argc, char ** argv)
     cstop(argv[cname]);
 }
 
+void
+tpin(int argc, char ** argv)
+{
+    int cname = 0, cpus = 1, args = 2, mask;
+    if (argc != args) error();
+    if ((mask = cpumask(argv[cpus])) < 0)
+    {
+        printf("invalid cpu list <%s>\n", argv[cpus]);
+        error();
+    }
+    if (csetaffinity(argv[cname], mask) < 0)
+    {
+        printf("could not pin container<%s>\n", argv[cname]);
+        error();
+    }
+}
+
+void
+tweight(int argc, char ** argv)
+{
+    int cname = 0, weight = 1, args = 2;
+    if (argc != args) error();
+    if (csetweight(argv[cname], atoi(argv[weight])) < 0)
+    {
+        printf("could not weight container<%s>\n", argv[cname]);
+        error();
+    }
+}
+
+void
+trt(int argc, char ** argv)
+{
+    int cname = 0, runtime = 1, period = 2, args = 3;
+    if (argc != args) error();
+    if (csetrt(argv[cname], atoi(argv[runtime]), atoi(argv[period])) < 0)
+    {
+        printf("could not admit container<%s> as real-time\n", argv[cname]);
+        error();
+    }
+}
+
 int
 main(int argc, char ** argv)
 {
@@ -298,6 +352,18 @@ main(int argc, char ** argv)
     {
         tstop(argc - used_params, &argv[arg_start]);
     }
+    else if(strcmp(argv[cmd], tools[CPIN]) == 0)
+    {
+        tpin(argc - used_params, &argv[arg_start]);
+    }
+    else if(strcmp(argv[cmd], tools[CSETWEIGHT]) == 0)
+    {
+        tweight(argc - used_params, &argv[arg_start]);
+    }
+    else if(strcmp(argv[cmd], tools[CSETRT]) == 0)
+    {
+        trt(argc - used_params, &argv[arg_start]);
+    }
     else
     {
         error();
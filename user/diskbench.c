@@ -0,0 +1,82 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "user/user.h"
+
+// parallel disk benchmark: 1 to all harts, one process pinned
+// to each, read random blocks of the root disk for MS
+// milliseconds, straight through the driver. with a request
+// queue per hart, throughput should grow with the harts rather
+// than stall on one driver lock.
+
+#define MS 500
+
+// run the benchmark on harts 0..nh-1 and report.
+void
+run(int nh)
+{
+  int i, n, min, max, total, go[2], res[2];
+  char c;
+
+  if(pipe(go) < 0 || pipe(res) < 0){
+    fprintf(2, "diskbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nh; i++){
+    if(fork() == 0){
+      close(go[1]);
+      close(res[0]);
+      setaffinity(0, 1 << i);
+      // wait until every hart is ready.
+      read(go[0], &c, 1);
+      n = diskbench(MS);
+      write(res[1], &n, sizeof(n));
+      exit(0);
+    }
+  }
+  close(go[0]);
+  close(res[1]);
+  close(go[1]); // start them all
+  total = max = 0;
+  min = -1;
+  for(i = 0; i < nh; i++){
+    if(read(res[0], &n, sizeof(n)) != sizeof(n) || n < 0){
+      fprintf(2, "diskbench: lost a result\n");
+      exit(1);
+    }
+    total += n;
+    if(n > max)
+      max = n;
+    if(min < 0 || n < min)
+      min = n;
+  }
+  close(res[0]);
+  for(i = 0; i < nh; i++)
+    wait(0);
+  printf("%d\t%d\t%d\t\t%d\t%d\n", nh, total, total * 1000 / MS, min, max);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct hartstat hs[NCPU];
+  struct diskstat st;
+  int nh, ncpu;
+
+  if((ncpu = hartstat(hs, NCPU)) <= 0){
+    fprintf(2, "diskbench: hartstat failed\n");
+    exit(1);
+  }
+  if(diskstat(&st, 1) != 1){
+    fprintf(2, "diskbench: diskstat failed\n");
+    exit(1);
+  }
+  printf("disk %d: %d queues\n", st.disk, st.nqueue);
+  printf("HARTS\tREADS\tREADS/s\t\tMIN\tMAX\n");
+  for(nh = 1; nh <= ncpu; nh++)
+    run(nh);
+  exit(0);
+}
@@ -0,0 +1,138 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// lock contention benchmark: NT threads, more than there are
+// harts, take turns bumping a counter under a spinlock and then
+// under a futex mutex. spinners burn whole timeslices waiting for
+// a preempted holder; futex waiters sleep and leave the hart free.
+// a producer/consumer run checks the condition variables.
+
+#define NT 8
+#define ITER 2000
+#define NITEM 1000
+#define QSIZE 4
+
+int spin;
+struct mutex m;
+volatile int counter;
+
+void
+spinworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < ITER; i++){
+    while(__sync_lock_test_and_set(&spin, 1) != 0)
+      ;
+    counter++;
+    __sync_lock_release(&spin);
+  }
+}
+
+void
+mutexworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < ITER; i++){
+    mutex_lock(&m);
+    counter++;
+    mutex_unlock(&m);
+  }
+}
+
+int
+run(char *name, void (*fn)(void*))
+{
+  int i, start, ticks, tids[NT];
+
+  counter = 0;
+  start = uptime();
+  for(i = 0; i < NT; i++){
+    if((tids[i] = kthread_create(fn, 0)) < 0){
+      printf("futexbench: kthread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < NT; i++)
+    kthread_join(tids[i], 0);
+  ticks = uptime() - start;
+  if(counter != NT * ITER){
+    printf("futexbench: %s: counter %d, want %d\n", name, counter, NT * ITER);
+    exit(1);
+  }
+  printf("%s: %d threads x %d lock/unlock in %d ticks\n", name, NT, ITER, ticks);
+  return ticks;
+}
+
+struct mutex qlock;
+struct cond notempty, notfull;
+int queue[QSIZE], head, tail, nq;
+int consumed;
+
+void
+producer(void *arg)
+{
+  int i;
+
+  for(i = 1; i <= NITEM; i++){
+    mutex_lock(&qlock);
+    while(nq == QSIZE)
+      cond_wait(&notfull, &qlock);
+    queue[tail++ % QSIZE] = i;
+    nq++;
+    cond_signal(&notempty);
+    mutex_unlock(&qlock);
+  }
+}
+
+void
+consumer(void *arg)
+{
+  int i, v;
+
+  for(i = 0; i < NITEM; i++){
+    mutex_lock(&qlock);
+    while(nq == 0)
+      cond_wait(&notempty, &qlock);
+    v = queue[head++ % QSIZE];
+    nq--;
+    consumed += v;
+    cond_signal(&notfull);
+    mutex_unlock(&qlock);
+  }
+}
+
+void
+condtest(void)
+{
+  int p, c;
+
+  printf("condtest: ");
+  mutex_init(&qlock);
+  cond_init(&notempty);
+  cond_init(&notfull);
+  if((p = kthread_create(producer, 0)) < 0 || (c = kthread_create(consumer, 0)) < 0){
+    printf("kthread_create failed\n");
+    exit(1);
+  }
+  kthread_join(p, 0);
+  kthread_join(c, 0);
+  if(consumed != NITEM * (NITEM + 1) / 2){
+    printf("consumed %d\n", consumed);
+    exit(1);
+  }
+  printf("OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  mutex_init(&m);
+  run("spinlock", spinworker);
+  run("futex mutex", mutexworker);
+  condtest();
+  exit(0);
+}
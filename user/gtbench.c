@@ -0,0 +1,136 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/gthread.h"
+
+// exercises the gthread runtime: fork-join recursion, yields,
+// and a parallel-for timed on one worker and on every hart.
+
+#define NPRIME 200000
+#define GRAIN  500
+
+int nprimes;
+
+int
+isprime(int n)
+{
+  int d;
+
+  if(n < 2)
+    return 0;
+  for(d = 2; d * d <= n; d++)
+    if(n % d == 0)
+      return 0;
+  return 1;
+}
+
+void
+primebody(int i, void *arg)
+{
+  if(isprime(i))
+    __sync_fetch_and_add(&nprimes, 1);
+}
+
+void
+primes(void *arg)
+{
+  gt_parfor(0, NPRIME, GRAIN, primebody, 0);
+}
+
+struct fibarg {
+  int n;
+  int r;
+};
+
+void
+fib(void *arg)
+{
+  struct fibarg *f = arg, a, b;
+  struct gthread *t;
+
+  if(f->n < 2){
+    f->r = f->n;
+    return;
+  }
+  a.n = f->n - 1;
+  b.n = f->n - 2;
+  t = gt_spawn(fib, &a);
+  fib(&b);
+  if(t)
+    gt_join(t);
+  else
+    fib(&a);
+  f->r = a.r + b.r;
+}
+
+int yields;
+
+void
+yielder(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 100; i++){
+    __sync_fetch_and_add(&yields, 1);
+    gt_yield();
+  }
+}
+
+void
+yieldtest(void *arg)
+{
+  struct gthread *t[8];
+  int i;
+
+  for(i = 0; i < 8; i++)
+    t[i] = gt_spawn(yielder, 0);
+  for(i = 0; i < 8; i++)
+    if(t[i])
+      gt_join(t[i]);
+}
+
+int
+timeprimes(int n)
+{
+  int start;
+
+  nprimes = 0;
+  start = uptime();
+  if(gt_run(n, primes, 0) < 0){
+    printf("gtbench: gt_run failed\n");
+    exit(1);
+  }
+  if(nprimes != 17984){
+    printf("gtbench: %d primes below %d, want 17984\n", nprimes, NPRIME);
+    exit(1);
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fibarg f;
+  int t1, tn;
+
+  printf("fib: ");
+  f.n = 18;
+  if(gt_run(0, fib, &f) < 0 || f.r != 2584){
+    printf("fib(18) = %d, want 2584\n", f.r);
+    exit(1);
+  }
+  printf("OK\n");
+
+  printf("yield: ");
+  if(gt_run(0, yieldtest, 0) < 0 || yields != 800){
+    printf("%d yields, want 800\n", yields);
+    exit(1);
+  }
+  printf("OK\n");
+
+  t1 = timeprimes(1);
+  tn = timeprimes(0);
+  printf("parfor: primes below %d in %d ticks on 1 worker, %d ticks on all harts\n",
+         NPRIME, t1, tn);
+  exit(0);
+}
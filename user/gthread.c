@@ -0,0 +1,476 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/gthread.h"
+
+// M:N green threads.
+//
+// gt_run() starts one worker per hart: the caller plus kernel
+// threads from kthread_create(). Each worker has a deque of
+// runnable gthreads. It pushes and pops its own work at the
+// bottom, so a fork-join program keeps running the newest, cache-
+// warm tasks. An idle worker steals the oldest task from the top
+// of someone else's deque, and sleeps on a futex when there is
+// nothing to steal anywhere.
+//
+// Switching gthreads is a user-level gt_switch()
+// (gthread_switch.S), with no system call involved. A worker
+// finds its own struct worker through the tp register, which
+// nothing else in user space uses. tp belongs to the kernel
+// thread, so it stays right when a gthread migrates.
+
+#define GSTACKSIZE (4*4096)
+#define IDLEWAIT   10000000 // ns an idle worker sleeps before looking again
+
+enum gstate { GRUNNABLE, GBLOCKED, GDONE };
+
+// callee-saved registers, as saved by gt_switch().
+struct context {
+  uint64 ra;
+  uint64 sp;
+  uint64 s[12];
+};
+
+struct gthread {
+  struct context context;
+  struct gthread *next;     // on a deque or the free list
+  struct gthread *prev;
+  enum gstate state;        // why it last switched to its worker
+  void (*fn)(void*);
+  void *arg;
+  struct mutex lock;        // protects done and joiner
+  int done;
+  struct gthread *joiner;   // blocked in gt_join() on this one
+  char *stack;
+};
+
+struct worker {
+  struct context sched;     // the worker's own loop
+  struct gthread *cur;      // running on this worker, or 0
+  struct mutex *unlock;     // to release once cur is switched out
+  struct mutex lock;        // protects the deque
+  struct gthread *top;      // oldest, stolen first
+  struct gthread *bottom;   // newest, run first by the owner
+  int tid;                  // kernel thread, for kthread_join()
+  uint seed;                // for picking victims
+};
+
+static struct {
+  struct worker *workers;
+  int n;
+  struct gthread *root;     // gt_run()'s fn
+  volatile int shutdown;
+  int idle;                 // workers asleep in futex_wait
+  int seq;                  // bumped whenever work shows up
+  struct mutex freelock;
+  struct gthread *free;     // finished gthreads, stacks included
+} g;
+
+extern void gt_switch(uint64, uint64);
+
+static struct worker*
+self(void)
+{
+  struct worker *w;
+
+  asm volatile("mv %0, tp" : "=r" (w));
+  return w;
+}
+
+static void
+setself(struct worker *w)
+{
+  asm volatile("mv tp, %0" : : "r" (w));
+}
+
+// deque operations; caller holds w->lock.
+
+static void
+pushbottom(struct worker *w, struct gthread *t)
+{
+  t->next = 0;
+  t->prev = w->bottom;
+  if(w->bottom)
+    w->bottom->next = t;
+  else
+    w->top = t;
+  w->bottom = t;
+}
+
+static void
+pushtop(struct worker *w, struct gthread *t)
+{
+  t->prev = 0;
+  t->next = w->top;
+  if(w->top)
+    w->top->prev = t;
+  else
+    w->bottom = t;
+  w->top = t;
+}
+
+static struct gthread*
+popbottom(struct worker *w)
+{
+  struct gthread *t = w->bottom;
+
+  if(t){
+    w->bottom = t->prev;
+    if(w->bottom)
+      w->bottom->next = 0;
+    else
+      w->top = 0;
+  }
+  return t;
+}
+
+static struct gthread*
+poptop(struct worker *w)
+{
+  struct gthread *t = w->top;
+
+  if(t){
+    w->top = t->next;
+    if(w->top)
+      w->top->prev = 0;
+    else
+      w->bottom = 0;
+  }
+  return t;
+}
+
+// there's new work; wake a sleeping worker, if any.
+static void
+notify(void)
+{
+  __sync_synchronize();
+  if(g.idle > 0){
+    __sync_fetch_and_add(&g.seq, 1);
+    futex_wake(&g.seq, 1);
+  }
+}
+
+// Make t runnable on worker w. yielded gthreads go on top,
+// so everything else queued on w runs first.
+static void
+ready(struct worker *w, struct gthread *t, int yielded)
+{
+  mutex_lock(&w->lock);
+  if(yielded)
+    pushtop(w, t);
+  else
+    pushbottom(w, t);
+  mutex_unlock(&w->lock);
+  notify();
+}
+
+// Find something to run: w's own newest, else another
+// worker's oldest, starting from a pseudo-random victim.
+static struct gthread*
+findwork(struct worker *w)
+{
+  struct gthread *t;
+  struct worker *v;
+  int i, start;
+
+  mutex_lock(&w->lock);
+  t = popbottom(w);
+  mutex_unlock(&w->lock);
+  if(t)
+    return t;
+
+  w->seed = w->seed * 1103515245 + 12345;
+  start = (w->seed >> 16) % g.n;
+  for(i = 0; i < g.n; i++){
+    v = &g.workers[(start + i) % g.n];
+    if(v == w || v->top == 0)
+      continue;
+    mutex_lock(&v->lock);
+    t = poptop(v);
+    mutex_unlock(&v->lock);
+    if(t)
+      return t;
+  }
+  return 0;
+}
+
+static void
+gfree(struct gthread *t)
+{
+  mutex_lock(&g.freelock);
+  t->next = g.free;
+  g.free = t;
+  mutex_unlock(&g.freelock);
+}
+
+// t switched back to worker w; deal with why.
+static void
+switched(struct worker *w, struct gthread *t)
+{
+  struct gthread *j;
+
+  switch(t->state){
+  case GRUNNABLE:
+    ready(w, t, 1);
+    break;
+  case GBLOCKED:
+    // t is parked on a lock's waiter; now that its registers
+    // are saved, it's safe to let its waker see it.
+    break;
+  case GDONE:
+    mutex_lock(&t->lock);
+    t->done = 1;
+    j = t->joiner;
+    mutex_unlock(&t->lock);
+    if(t == g.root){
+      g.shutdown = 1;
+      __sync_fetch_and_add(&g.seq, 1);
+      futex_wake(&g.seq, g.n);
+    } else if(j){
+      ready(w, j, 0);
+    }
+    break;
+  }
+  if(w->unlock){
+    mutex_unlock(w->unlock);
+    w->unlock = 0;
+  }
+}
+
+// A worker's scheduling loop; returns once the root gthread is done.
+static void
+workerloop(struct worker *w)
+{
+  struct gthread *t;
+  int seq;
+
+  while(!g.shutdown){
+    if((t = findwork(w)) != 0){
+      w->cur = t;
+      gt_switch((uint64)&w->sched, (uint64)&t->context);
+      w->cur = 0;
+      switched(w, t);
+      continue;
+    }
+    // advertise that we're going idle before the last look,
+    // so that notify() can't miss us.
+    __sync_fetch_and_add(&g.idle, 1);
+    seq = g.seq;
+    if((t = findwork(w)) != 0){
+      __sync_fetch_and_sub(&g.idle, 1);
+      ready(w, t, 0);
+      continue;
+    }
+    if(!g.shutdown)
+      futex_wait(&g.seq, seq, IDLEWAIT);
+    __sync_fetch_and_sub(&g.idle, 1);
+  }
+}
+
+static void
+workermain(void *arg)
+{
+  struct worker *w = arg;
+
+  setself(w);
+  workerloop(w);
+}
+
+// Every gthread starts here, on its own stack.
+static void
+gentry(void)
+{
+  struct worker *w = self();
+  struct gthread *t = w->cur;
+
+  t->fn(t->arg);
+
+  // we may have migrated while fn ran.
+  w = self();
+  t->state = GDONE;
+  gt_switch((uint64)&t->context, (uint64)&w->sched);
+}
+
+static struct gthread*
+galloc(void (*fn)(void*), void *arg)
+{
+  struct gthread *t;
+
+  mutex_lock(&g.freelock);
+  if((t = g.free) != 0)
+    g.free = t->next;
+  mutex_unlock(&g.freelock);
+  if(t == 0){
+    if((t = malloc(sizeof(*t))) == 0)
+      return 0;
+    if((t->stack = malloc(GSTACKSIZE)) == 0){
+      free(t);
+      return 0;
+    }
+  }
+  memset(&t->context, 0, sizeof(t->context));
+  t->context.ra = (uint64)gentry;
+  t->context.sp = (uint64)(t->stack + GSTACKSIZE);
+  t->fn = fn;
+  t->arg = arg;
+  t->state = GRUNNABLE;
+  mutex_init(&t->lock);
+  t->done = 0;
+  t->joiner = 0;
+  return t;
+}
+
+// Start fn(arg) as a new gthread, on the caller's worker.
+// Returns a handle for gt_join(), or 0 if out of memory.
+struct gthread*
+gt_spawn(void (*fn)(void*), void *arg)
+{
+  struct gthread *t;
+
+  if((t = galloc(fn, arg)) == 0)
+    return 0;
+  ready(self(), t, 0);
+  return t;
+}
+
+// Let other gthreads run.
+void
+gt_yield(void)
+{
+  struct worker *w = self();
+  struct gthread *t = w->cur;
+
+  t->state = GRUNNABLE;
+  gt_switch((uint64)&t->context, (uint64)&w->sched);
+}
+
+// Wait for t to finish, then free it.
+// Each gthread must be joined exactly once.
+void
+gt_join(struct gthread *t)
+{
+  struct worker *w = self();
+  struct gthread *cur = w->cur;
+
+  mutex_lock(&t->lock);
+  if(!t->done){
+    // block; the worker drops t->lock once our registers
+    // are saved, and t's worker readies us when t is done.
+    t->joiner = cur;
+    cur->state = GBLOCKED;
+    w->unlock = &t->lock;
+    gt_switch((uint64)&cur->context, (uint64)&w->sched);
+    mutex_lock(&t->lock);
+  }
+  mutex_unlock(&t->lock);
+  gfree(t);
+}
+
+int
+gt_nworkers(void)
+{
+  return g.n;
+}
+
+struct pfor {
+  int lo, hi, grain;
+  void (*body)(int, void*);
+  void *arg;
+};
+
+static void
+pfor1(void *arg)
+{
+  struct pfor *p = arg;
+
+  gt_parfor(p->lo, p->hi, p->grain, p->body, p->arg);
+}
+
+// Call body(i, arg) for every i in [lo, hi), splitting the
+// range in halves until pieces are at most grain long, and
+// spreading the pieces over the workers by stealing.
+void
+gt_parfor(int lo, int hi, int grain, void (*body)(int, void*), void *arg)
+{
+  struct pfor right;
+  struct gthread *t;
+  int i, mid;
+
+  if(grain < 1)
+    grain = 1;
+  if(hi - lo > grain){
+    mid = lo + (hi - lo) / 2;
+    right.lo = mid;
+    right.hi = hi;
+    right.grain = grain;
+    right.body = body;
+    right.arg = arg;
+    if((t = gt_spawn(pfor1, &right)) != 0){
+      gt_parfor(lo, mid, grain, body, arg);
+      gt_join(t);
+      return;
+    }
+    // out of memory; do it all here.
+  }
+  for(i = lo; i < hi; i++)
+    body(i, arg);
+}
+
+// Run fn(arg) as a gthread on n workers (0 for one per hart
+// the caller may use) and return once it's done. fn must join
+// the gthreads it spawns. Returns -1 if it couldn't start.
+int
+gt_run(int n, void (*fn)(void*), void *arg)
+{
+  struct gthread *t;
+  int i, mask;
+
+  if(n <= 0){
+    n = 0;
+    mask = getaffinity(0);
+    for(i = 0; i < NCPU; i++)
+      if(mask & (1 << i))
+        n++;
+    if(n == 0)
+      n = 1;
+  }
+  if(n > NTHREAD)
+    n = NTHREAD;
+  if((g.workers = malloc(n * sizeof(struct worker))) == 0)
+    return -1;
+  memset(g.workers, 0, n * sizeof(struct worker));
+  g.n = n;
+  g.shutdown = 0;
+  g.idle = 0;
+  g.seq = 0;
+  mutex_init(&g.freelock);
+  for(i = 0; i < n; i++){
+    mutex_init(&g.workers[i].lock);
+    g.workers[i].seed = i + 1;
+  }
+
+  if((g.root = t = galloc(fn, arg)) == 0){
+    free(g.workers);
+    return -1;
+  }
+  pushbottom(&g.workers[0], t);
+
+  for(i = 1; i < n; i++)
+    g.workers[i].tid = kthread_create(workermain, &g.workers[i]);
+  setself(&g.workers[0]);
+  workerloop(&g.workers[0]);
+  for(i = 1; i < n; i++)
+    if(g.workers[i].tid > 0)
+      kthread_join(g.workers[i].tid, 0);
+
+  gfree(g.root);
+  while((t = g.free) != 0){
+    g.free = t->next;
+    free(t->stack);
+    free(t);
+  }
+  free(g.workers);
+  g.workers = 0;
+  return 0;
+}
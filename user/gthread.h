@@ -0,0 +1,12 @@
+// M:N green threads: many gthreads multiplexed onto one kernel
+// thread per hart, with per-worker run queues and work stealing.
+// See gthread.c.
+
+struct gthread;
+
+int             gt_run(int, void (*)(void*), void*);
+int             gt_nworkers(void);
+struct gthread* gt_spawn(void (*)(void*), void*);
+void            gt_join(struct gthread*);
+void            gt_yield(void);
+void            gt_parfor(int, int, int, void (*)(int, void*), void*);
@@ -0,0 +1,27 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "user/user.h"
+
+// print each online hart's run queue and load balancer counters.
+int
+main(int argc, char *argv[])
+{
+  struct hartstat st[NCPU];
+  int i, n;
+
+  if((n = hartstat(st, NCPU)) < 0){
+    fprintf(2, "harts: hartstat failed\n");
+    exit(1);
+  }
+  printf("HART\tSTATE\tPID\tQUEUED\tLOAD\tMIGIN\tMIGOUT\tBALANCE\n");
+  for(i = 0; i < n; i++){
+    printf("%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\n", st[i].hart,
+           st[i].idle ? "idle" : "busy", st[i].pid, st[i].nrunnable,
+           st[i].load, st[i].nmigratein, st[i].nmigrateout, st[i].nbalance);
+  }
+  exit(0);
+}
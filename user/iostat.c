@@ -0,0 +1,112 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// print each disk's queue statistics and wait latencies; with
+// a command, only those of the I/O done while it ran. -p turns
+// completion polling on a disk on or off first.
+//   iostat [-p disk on|off] [command [args ...]]
+
+// the latency under which pct percent of waits finished, in
+// microseconds, to within the power of two of lat[].
+int
+pctile(uint *lat, int pct)
+{
+  uint total, sum;
+  int i;
+
+  total = 0;
+  for(i = 0; i < NLAT; i++)
+    total += lat[i];
+  if(total == 0)
+    return 0;
+  sum = 0;
+  for(i = 0; i < NLAT-1; i++){
+    sum += lat[i];
+    if(sum * 100 >= total * pct)
+      break;
+  }
+  return 2 << i;
+}
+
+void
+print(struct diskstat *st, int n)
+{
+  int i;
+  uint64 avg;
+
+  printf("DISK\tQUEUES\tQUEUED\tMAXQ\tAVGQ\tSUBMIT\tQFULL\tMERGE\tREAD\tWRITE\tNOTIFY\tINTR\n");
+  for(i = 0; i < n; i++){
+    avg = st[i].nsubmit ? st[i].depthsum * 100 / st[i].nsubmit : 0;
+    printf("%d\t%d\t%d\t%d\t%d.%d%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", st[i].disk,
+           st[i].nqueue, st[i].depth, st[i].maxdepth, (int)(avg / 100),
+           (int)(avg / 10 % 10), (int)(avg % 10), st[i].nsubmit,
+           st[i].nqfull, st[i].nmerge, st[i].nread, st[i].nwrite, st[i].nnotify,
+           st[i].nintr);
+  }
+  printf("DISK\tPOLL\tDEVLAT\tPOLLED\tMISSED\tP50\tP90\tP99\t(us)\n");
+  for(i = 0; i < n; i++)
+    printf("%d\t%s\t%d\t%d\t%d\t<%d\t<%d\t<%d\n", st[i].disk,
+           st[i].poll ? "on" : "off", st[i].devlat, st[i].npoll,
+           st[i].npollmiss, pctile(st[i].lat, 50), pctile(st[i].lat, 90),
+           pctile(st[i].lat, 99));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct diskstat before[NDISK], after[NDISK];
+  int i, j, n, pid;
+
+  if(argc >= 4 && strcmp(argv[1], "-p") == 0){
+    if(diskpoll(atoi(argv[2]), strcmp(argv[3], "on") == 0) < 0){
+      fprintf(2, "iostat: no disk %s\n", argv[2]);
+      exit(1);
+    }
+    argc -= 3;
+    argv += 3;
+  }
+  if((n = diskstat(before, NDISK)) < 0){
+    fprintf(2, "iostat: diskstat failed\n");
+    exit(1);
+  }
+  if(argc < 2){
+    print(before, n);
+    exit(0);
+  }
+
+  if((pid = fork()) < 0){
+    fprintf(2, "iostat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "iostat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+
+  if(diskstat(after, NDISK) != n){
+    fprintf(2, "iostat: diskstat failed\n");
+    exit(1);
+  }
+  // maxdepth, depth and devlat are left as they are, not
+  // differenced.
+  for(i = 0; i < n; i++){
+    after[i].depthsum -= before[i].depthsum;
+    after[i].nsubmit -= before[i].nsubmit;
+    after[i].nqfull -= before[i].nqfull;
+    after[i].nmerge -= before[i].nmerge;
+    after[i].nread -= before[i].nread;
+    after[i].nwrite -= before[i].nwrite;
+    after[i].nnotify -= before[i].nnotify;
+    after[i].nintr -= before[i].nintr;
+    after[i].npoll -= before[i].npoll;
+    after[i].npollmiss -= before[i].npollmiss;
+    for(j = 0; j < NLAT; j++)
+      after[i].lat[j] -= before[i].lat[j];
+  }
+  print(after, n);
+  exit(0);
+}
@@ -0,0 +1,81 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "user/user.h"
+
+// kernel spinlock benchmark: 1 to all harts, one process pinned
+// to each, take the same kernel lock for MS milliseconds, first
+// as the old test-and-set spinlock and then as the ticket lock
+// acquire() now uses. prints total throughput and fairness, the
+// fewest acquisitions any one hart got as a share of the most.
+
+#define MS 200
+
+static char *kinds[] = { "ticket", "tas" };
+
+// run the benchmark on harts 0..nh-1 and report.
+void
+run(int tas, int nh)
+{
+  int i, n, min, max, total, go[2], res[2];
+  char c;
+
+  if(pipe(go) < 0 || pipe(res) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nh; i++){
+    if(fork() == 0){
+      close(go[1]);
+      close(res[0]);
+      setaffinity(0, 1 << i);
+      // wait until every hart is ready.
+      read(go[0], &c, 1);
+      n = lockbench(tas, MS);
+      write(res[1], &n, sizeof(n));
+      exit(0);
+    }
+  }
+  close(go[0]);
+  close(res[1]);
+  close(go[1]); // start them all
+  total = max = 0;
+  min = -1;
+  for(i = 0; i < nh; i++){
+    if(read(res[0], &n, sizeof(n)) != sizeof(n)){
+      fprintf(2, "lockbench: lost a result\n");
+      exit(1);
+    }
+    total += n;
+    if(n > max)
+      max = n;
+    if(min < 0 || n < min)
+      min = n;
+  }
+  close(res[0]);
+  for(i = 0; i < nh; i++)
+    wait(0);
+  printf("%s\t%d\t%d\t\t%d\t%d\t%d%%\n", kinds[tas], nh, total / MS, min, max,
+         max ? min * 100 / max : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct hartstat hs[NCPU];
+  int nh, ncpu;
+
+  if((ncpu = hartstat(hs, NCPU)) <= 0){
+    fprintf(2, "lockbench: hartstat failed\n");
+    exit(1);
+  }
+  printf("LOCK\tHARTS\tACQ/ms\t\tMIN\tMAX\tFAIR\n");
+  for(nh = 1; nh <= ncpu; nh++){
+    run(1, nh);
+    run(0, nh);
+  }
+  exit(0);
+}
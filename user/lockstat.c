@@ -0,0 +1,30 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// control and print kernel lock statistics (see sys_ntas).
+//
+//   lockstat start   clear the statistics and start collecting
+//   lockstat stop    stop collecting
+//   lockstat [wait]  print the locks with the most wait time
+//   lockstat hold    print the locks with the most hold time
+
+int
+main(int argc, char *argv[])
+{
+  char *cmd = argc > 1 ? argv[1] : "wait";
+
+  if(strcmp(cmd, "start") == 0)
+    ntas(0);
+  else if(strcmp(cmd, "stop") == 0)
+    ntas(-1);
+  else if(strcmp(cmd, "wait") == 0)
+    ntas(1);
+  else if(strcmp(cmd, "hold") == 0)
+    ntas(2);
+  else {
+    fprintf(2, "usage: lockstat [start|stop|wait|hold]\n");
+    exit(1);
+  }
+  exit(0);
+}
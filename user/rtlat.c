@@ -0,0 +1,67 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "user/user.h"
+
+// wakeup latency test for the real-time class.
+//
+//   rtlat hog <n>      spin n processes until killed
+//   rtlat [samples]    sleep 1ms at a time, then report how long
+//                      each wakeup took to get a hart
+//
+// run the hogs in one container and the sampler in another,
+// once as is and once after "ctool rt <container> 2000 10000",
+// and compare the sampler's average and worst latency.
+
+#define NSTAT (NPROC + NCONTAINERS)
+#define CYCLES_PER_US (CLINT_FREQ / 1000000)
+
+// too big for the user stack.
+struct cpustat st[NSTAT];
+
+void
+hog(int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(fork() == 0){
+      for(;;)
+        ;
+    }
+  }
+  for(i = 0; i < n; i++)
+    wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, samples, pid;
+
+  if(argc == 3 && strcmp(argv[1], "hog") == 0){
+    hog(atoi(argv[2]));
+    exit(0);
+  }
+  samples = argc > 1 ? atoi(argv[1]) : 1000;
+  for(i = 0; i < samples; i++)
+    nanosleep(1000000);
+
+  if((n = cpustat(st, NSTAT)) < 0){
+    fprintf(2, "rtlat: cpustat failed\n");
+    exit(1);
+  }
+  pid = getpid();
+  for(i = 0; i < n; i++){
+    if(st[i].pid != pid || st[i].nwakeup == 0)
+      continue;
+    printf("rtlat: %d wakeups, avg %d us, max %d us\n", st[i].nwakeup,
+           (int)(st[i].wakesum / st[i].nwakeup / CYCLES_PER_US),
+           (int)(st[i].wakemax / CYCLES_PER_US));
+  }
+  exit(0);
+}
@@ -0,0 +1,134 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/spinlock.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
+#include "user/user.h"
+
+// print scheduler statistics.
+//
+//   schedstat          switch counts and latency/timeslice percentiles
+//                      per process, then per container
+//   schedstat -h name  full histograms of one process (by pid) or
+//                      container (by name)
+//   schedstat -r       reset the statistics after printing them
+
+#define NSTAT (NPROC + NCONTAINERS)
+#define CYCLES_PER_US (CLINT_FREQ / 1000000)
+
+// too big for the user stack.
+struct schedstat st[NSTAT];
+
+// microseconds at the top of histogram bucket b.
+static int
+bucketus(int b)
+{
+  return (int)((2L << b) / CYCLES_PER_US);
+}
+
+// upper bound, in microseconds, of the pct'th percentile of h.
+static int
+percentile(uint *h, int pct)
+{
+  int b;
+  uint total, sum;
+
+  total = 0;
+  for(b = 0; b < NSCHEDHIST; b++)
+    total += h[b];
+  if(total == 0)
+    return 0;
+  sum = 0;
+  for(b = 0; b < NSCHEDHIST; b++){
+    sum += h[b];
+    if(sum * 100 >= total * pct)
+      break;
+  }
+  return bucketus(b);
+}
+
+static void
+summary(struct schedstat *s)
+{
+  printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+         s->h.nvcsw, s->h.nivcsw,
+         percentile(s->h.runlat, 50), percentile(s->h.runlat, 99),
+         percentile(s->h.slice, 50), percentile(s->h.slice, 99),
+         percentile(s->h.slice, 100));
+}
+
+static void
+histogram(char *title, uint *h)
+{
+  int b, lo;
+
+  printf("%s\n", title);
+  for(b = 0; b < NSCHEDHIST; b++){
+    if(h[b] == 0)
+      continue;
+    lo = b == 0 ? 0 : bucketus(b - 1);
+    if(b == NSCHEDHIST - 1)
+      printf("  %d us and up\t%d\n", lo, h[b]);
+    else
+      printf("  %d-%d us\t%d\n", lo, bucketus(b), h[b]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, reset, pid;
+  char *name;
+
+  reset = 0;
+  name = 0;
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-r") == 0)
+      reset = 1;
+    else if(strcmp(argv[i], "-h") == 0 && i + 1 < argc)
+      name = argv[++i];
+    else {
+      fprintf(2, "usage: schedstat [-r] [-h pid|container]\n");
+      exit(1);
+    }
+  }
+
+  if((n = schedstat(st, NSTAT, reset)) < 0){
+    fprintf(2, "schedstat failed\n");
+    exit(1);
+  }
+
+  if(name){
+    pid = atoi(name);
+    for(i = 0; i < n; i++){
+      if(pid ? st[i].pid != pid : (st[i].pid != 0 || strcmp(st[i].cname, name) != 0))
+        continue;
+      printf("%s %s: %d voluntary, %d involuntary switches\n",
+             st[i].pid ? st[i].name : "container", st[i].cname,
+             st[i].h.nvcsw, st[i].h.nivcsw);
+      histogram("runnable-to-running latency", st[i].h.runlat);
+      histogram("timeslice", st[i].h.slice);
+      exit(0);
+    }
+    fprintf(2, "schedstat: no process or container %s\n", name);
+    exit(1);
+  }
+
+  printf("PID\tNAME\tCONTAINER\tVCSW\tIVCSW\tLAT50\tLAT99\tRUN50\tRUN99\tRUNMAX (us)\n");
+  for(i = 0; i < n; i++){
+    if(st[i].pid == 0)
+      continue;
+    printf("%d\t%s\t%s\t\t", st[i].pid, st[i].name, st[i].cname);
+    summary(&st[i]);
+  }
+  printf("\nCONTAINER\tVCSW\tIVCSW\tLAT50\tLAT99\tRUN50\tRUN99\tRUNMAX (us)\n");
+  for(i = 0; i < n; i++){
+    if(st[i].pid != 0)
+      continue;
+    printf("%s\t\t", st[i].cname);
+    summary(&st[i]);
+  }
+  exit(0);
+}
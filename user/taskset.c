@@ -0,0 +1,32 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char **argv)
+{
+  int i, mask, pid;
+
+  if(argc == 2){
+    pid = atoi(argv[1]);
+    if((mask = getaffinity(pid)) < 0){
+      fprintf(2, "taskset: no process %d\n", pid);
+      exit(1);
+    }
+    printf("%d: %x\n", pid, mask);
+    exit(0);
+  }
+  if(argc < 3){
+    fprintf(2, "usage: taskset pid | taskset cpus pid...\n");
+    exit(1);
+  }
+  if((mask = cpumask(argv[1])) < 0){
+    fprintf(2, "taskset: bad cpu list %s\n", argv[1]);
+    exit(1);
+  }
+  for(i = 2; i < argc; i++){
+    if(setaffinity(atoi(argv[i]), mask) < 0)
+      fprintf(2, "taskset: cannot pin %s\n", argv[i]);
+  }
+  exit(0);
+}
@@ -0,0 +1,171 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// kernel threads: clone() and join() wrapped up with
+// stack management.
+
+#define TSTACKSIZE (4*4096)
+
+// where a new thread starts; kept at the top of its stack.
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+// stacks of threads not yet joined.
+static struct {
+  int tid;
+  void *stack;
+} tstacks[NTHREAD];
+static int tlock;
+
+static void
+tlock_acquire(void)
+{
+  while(__sync_lock_test_and_set(&tlock, 1) != 0)
+    ;
+}
+
+static void
+tlock_release(void)
+{
+  __sync_lock_release(&tlock);
+}
+
+static void
+thread_start(void *arg)
+{
+  struct tstart *ts = arg;
+
+  ts->fn(ts->arg);
+  exit(0);
+}
+
+// Run fn(arg) in a new thread sharing this process's memory.
+// Returns the thread's id for kthread_join(), or -1.
+int
+kthread_create(void (*fn)(void*), void *arg)
+{
+  char *stack;
+  struct tstart *ts;
+  int i, tid;
+
+  if((stack = malloc(TSTACKSIZE)) == 0)
+    return -1;
+  ts = (struct tstart*)(stack + TSTACKSIZE - sizeof(*ts));
+  ts = (struct tstart*)((uint64)ts & ~15L);
+  ts->fn = fn;
+  ts->arg = arg;
+
+  tlock_acquire();
+  for(i = 0; i < NTHREAD; i++)
+    if(tstacks[i].stack == 0)
+      break;
+  if(i == NTHREAD || (tid = clone(thread_start, ts, ts)) < 0){
+    tlock_release();
+    free(stack);
+    return -1;
+  }
+  tstacks[i].tid = tid;
+  tstacks[i].stack = stack;
+  tlock_release();
+  return tid;
+}
+
+// Wait for thread tid to finish and free its stack.
+// Sets *status (if not 0) to its exit status.
+// Returns tid, or -1.
+int
+kthread_join(int tid, int *status)
+{
+  int i;
+
+  if(join(tid, status) < 0)
+    return -1;
+  tlock_acquire();
+  for(i = 0; i < NTHREAD; i++){
+    if(tstacks[i].stack && tstacks[i].tid == tid){
+      free(tstacks[i].stack);
+      tstacks[i].stack = 0;
+      break;
+    }
+  }
+  tlock_release();
+  return tid;
+}
+
+// Mutexes and condition variables that sleep in the kernel,
+// via futexes, instead of spinning when contended.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->v = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->v, 0, 1)) == 0)
+    return;
+  // mark the mutex contended, so the unlocker knows to
+  // wake someone, and sleep until it's free.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->v, 2);
+  while(c != 0){
+    futex_wait(&m->v, 2, 0);
+    c = __sync_lock_test_and_set(&m->v, 2);
+  }
+}
+
+// Returns 1 if m was taken, 0 if it is held by someone else.
+int
+mutex_trylock(struct mutex *m)
+{
+  return __sync_val_compare_and_swap(&m->v, 0, 1) == 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->v, 1) != 1){
+    __sync_lock_release(&m->v);
+    futex_wake(&m->v, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait for a signal, and take m again.
+// Wakeups may be spurious; callers re-check their condition.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, 0);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
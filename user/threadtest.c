@@ -0,0 +1,207 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// tests for kernel threads: kthread_create(), kthread_join(),
+// and what happens to threads when their process exits.
+
+#define NT 4
+#define N (1 << 22)
+
+volatile int shared;
+uint64 partial[NTHREAD];
+
+// sum of i*i over one thread's share of [0, N).
+void
+work(void *arg)
+{
+  int id = (int)(uint64)arg;
+  int nt = shared;
+  uint64 i, s = 0;
+
+  for(i = id; i < N; i += nt)
+    s += i * i;
+  partial[id] = s;
+}
+
+// run work() on nt threads (the caller counts as one).
+// returns the number of ticks it took.
+int
+run(int nt)
+{
+  int i, start, tids[NTHREAD];
+
+  shared = nt;
+  start = uptime();
+  for(i = 1; i < nt; i++){
+    if((tids[i] = kthread_create(work, (void*)(uint64)i)) < 0){
+      printf("threadtest: kthread_create failed\n");
+      exit(1);
+    }
+  }
+  work((void*)0);
+  for(i = 1; i < nt; i++){
+    if(kthread_join(tids[i], 0) != tids[i]){
+      printf("threadtest: kthread_join failed\n");
+      exit(1);
+    }
+  }
+  return uptime() - start;
+}
+
+void
+sumtest(void)
+{
+  uint64 want, got;
+  int i, t1, tn;
+
+  printf("sumtest: ");
+  t1 = run(1);
+  want = partial[0];
+  tn = run(NT);
+  got = 0;
+  for(i = 0; i < NT; i++)
+    got += partial[i];
+  if(got != want){
+    printf("wrong sum\n");
+    exit(1);
+  }
+  printf("OK (1 thread %d ticks, %d threads %d ticks)\n", t1, NT, tn);
+}
+
+void
+quit(void *arg)
+{
+  exit(5);
+}
+
+void
+statustest(void)
+{
+  int tid, status;
+
+  printf("statustest: ");
+  if((tid = kthread_create(quit, 0)) < 0){
+    printf("kthread_create failed\n");
+    exit(1);
+  }
+  status = 0;
+  if(kthread_join(tid, &status) != tid || status != 5){
+    printf("join got status %d\n", status);
+    exit(1);
+  }
+  if(join(tid, 0) != -1){
+    printf("joined twice\n");
+    exit(1);
+  }
+  printf("OK\n");
+}
+
+void
+spin(void *arg)
+{
+  for(;;)
+    shared++;
+}
+
+// a process that exits leaves none of its threads behind.
+void
+exittest(void)
+{
+  int i, pid, xstatus;
+
+  printf("exittest: ");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NT; i++)
+      if(kthread_create(spin, 0) < 0)
+        exit(1);
+    sleep(1);
+    exit(7);
+  }
+  if(wait(&xstatus) != pid || xstatus != 7){
+    printf("wait got status %d\n", xstatus);
+    exit(1);
+  }
+  printf("OK\n");
+}
+
+// threads see each other's sbrk().
+void
+growtest(void *arg)
+{
+  char *p = sbrk(4096);
+
+  p[0] = 'x';
+  *(char**)arg = p;
+}
+
+void
+sbrktest(void)
+{
+  int tid;
+  char *p = 0;
+
+  printf("sbrktest: ");
+  if((tid = kthread_create(growtest, &p)) < 0 || kthread_join(tid, 0) != tid){
+    printf("thread failed\n");
+    exit(1);
+  }
+  if(p == 0 || p[0] != 'x'){
+    printf("memory not shared\n");
+    exit(1);
+  }
+  // with the thread joined, the memory is the process's own.
+  if(sbrk(-4096) == (char*)-1){
+    printf("shrink after join refused\n");
+    exit(1);
+  }
+  printf("OK\n");
+}
+
+void
+nop(void *arg)
+{
+}
+
+// a process whose threads have all been joined can exec().
+void
+exectest(void)
+{
+  int tid, pid, xstatus;
+  char *argv[] = { "echo", "OK", 0 };
+
+  printf("exectest: ");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if((tid = kthread_create(nop, 0)) < 0 || kthread_join(tid, 0) != tid)
+      exit(1);
+    exec("echo", argv);
+    exit(2);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("exec after join failed, status %d\n", xstatus);
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  sumtest();
+  statustest();
+  exittest();
+  sbrktest();
+  exectest();
+  printf("threadtest: all tests passed\n");
+  exit(0);
+}
@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +135,35 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// turn a hart list like "0,2-3" into an affinity mask, or -1 if malformed.
+int
+cpumask(const char *s)
+{
+  int mask = 0, lo, hi;
+
+  while(*s){
+    if(*s < '0' || *s > '9')
+      return -1;
+    lo = hi = atoi(s);
+    while(*s >= '0' && *s <= '9')
+      s++;
+    if(*s == '-'){
+      s++;
+      if(*s < '0' || *s > '9')
+        return -1;
+      hi = atoi(s);
+      while(*s >= '0' && *s <= '9')
+        s++;
+    }
+    if(lo > hi || hi >= NCPU)
+      return -1;
+    for(; lo <= hi; lo++)
+      mask |= 1 << lo;
+    if(*s == ',')
+      s++;
+    else if(*s)
+      return -1;
+  }
+  return mask ? mask : -1;
+}
@@ -21,8 +21,24 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// threads made by kthread_create() share the heap.
+static int mlock;
+
+static void
+mlock_acquire(void)
+{
+  while(__sync_lock_test_and_set(&mlock, 1) != 0)
+    ;
+}
+
+static void
+mlock_release(void)
+{
+  __sync_lock_release(&mlock);
+}
+
+static void
+free1(void *ap)
 {
   Header *bp, *p;
 
@@ -56,10 +72,18 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  free1((void*)(hp + 1));
   return freep;
 }
 
+void
+free(void *ap)
+{
+  mlock_acquire();
+  free1(ap);
+  mlock_release();
+}
+
 void*
 malloc(uint nbytes)
 {
@@ -67,6 +91,7 @@ malloc(uint nbytes)
   uint nunits;
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  mlock_acquire();
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +106,13 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      mlock_release();
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(nunits)) == 0)
+      if((p = morecore(nunits)) == 0){
+        mlock_release();
         return 0;
+      }
   }
 }
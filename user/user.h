@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct cpustat;
+struct hartstat;
+struct schedstat;
+struct diskstat;
 
 // system calls
 int fork(void);
@@ -36,11 +40,46 @@ int resume(const char*);
 int cinfo(void);
 int cpause(char*);
 int cresume(char*);
-int cstart(int, char*, char*, char*, char*);
+int cstart(int, char*, char*, char*, char*, int);
 int cstop(char*);
 int root_access(void);
 uint ticks(void);
 void freememory(void);
+int nanosleep(uint64);
+int setaffinity(int, int);
+int getaffinity(int);
+int csetaffinity(char*, int);
+int cpustat(struct cpustat*, int);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int, uint64);
+int futex_wake(int*, int);
+int hartstat(struct hartstat*, int);
+int csetweight(char*, int);
+int csetrt(char*, int, int);
+int schedstat(struct schedstat*, int, int);
+int lockbench(int, int);
+int diskstat(struct diskstat*, int);
+int diskbench(int);
+int diskpoll(int, int);
+
+// thread.c
+struct mutex {
+  int v; // 0 unlocked, 1 locked, 2 locked with waiters
+};
+struct cond {
+  int seq; // bumped by every signal
+};
+int kthread_create(void(*)(void*), void*);
+int kthread_join(int, int*);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -58,3 +97,4 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int cpumask(const char*);
@@ -1543,12 +1543,12 @@ iref(char *s)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// the forktest binary also does this. the proc table grows on
+// demand, so both run until fork can't get memory.
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = 10000 };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1565,7 +1565,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -1796,6 +1796,39 @@ sbrkarg(char *s)
   } 
 }
 
+// nanosleep() wakes at its deadline rather than at a clock tick,
+// and long sleeps, which go on the timer wheel's coarse levels,
+// last as long as they should.
+void
+nanosleeptest(char *s)
+{
+  int i, t0, half, two, short200;
+
+  t0 = uptime();
+  if(nanosleep(500000000) < 0){
+    printf("%s: nanosleep failed\n", s);
+    exit(1);
+  }
+  half = uptime() - t0;
+
+  t0 = uptime();
+  for(i = 0; i < 200; i++)
+    nanosleep(1000000);
+  short200 = uptime() - t0;
+  if(short200 > half + 2){
+    printf("%s: 200 1ms sleeps took %d ticks, 500ms took %d\n", s, short200, half);
+    exit(1);
+  }
+
+  t0 = uptime();
+  nanosleep(2000000000);
+  two = uptime() - t0;
+  if(two < 3 * half || two > 5 * half + 2){
+    printf("%s: 2s sleep took %d ticks, 500ms took %d\n", s, two, half);
+    exit(1);
+  }
+}
+
 void
 validatetest(char *s)
 {
@@ -2152,6 +2185,7 @@ main(int argc, char *argv[])
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
     {validatetest, "validatetest"},
+    {nanosleeptest, "nanosleeptest"},
     {stacktest, "stacktest"},
     {opentest, "opentest"},
     {writetest, "writetest"},
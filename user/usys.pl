@@ -50,4 +50,21 @@ entry("cstart");
 entry("cstop");
 entry("root_access");
 entry("ticks");
-entry("freememory");
\ No newline at end of file
+entry("freememory");
+entry("nanosleep");
+entry("setaffinity");
+entry("getaffinity");
+entry("csetaffinity");
+entry("cpustat");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("hartstat");
+entry("csetweight");
+entry("csetrt");
+entry("schedstat");
+entry("lockbench");
+entry("diskstat");
+entry("diskbench");
+entry("diskpoll");